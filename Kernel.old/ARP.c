@@ -55,8 +55,7 @@ int ARP_in(ethernet2_packet* pkt)
 		}
 
 		/* Free packet */
-		kfree(pkt->data);
-		kfree(pkt);
+		ethernet_freePacket(pkt);
 		return 0;
 	}
 	return -1;
@@ -2,8 +2,25 @@
 
 #include "stdio.h"
 #include "string.h"
+#include "ObjectCache.h"
 #include "LinkedList.h"
 
+/* Cache for the list elements, which are allocated for every append */
+static ObjectCache* LinkedList_elementCache = NULL;
+
+/* Function:   LinkedList_initialize
+ * Purpose:    to create the cache list elements are allocated from. Must be
+ *             called before any element is appended to a list.
+ * Parameters: None.
+ * Returns:    0 in case of success, -1 otherwise (kmalloc failed). */
+int LinkedList_initialize(void)
+{
+	LinkedList_elementCache = ObjectCache_create("LinkedList_element",
+		sizeof(LinkedList_element), 0, NULL);
+
+	return LinkedList_elementCache ? 0 : -1;
+}
+
 /* Function:   LinkedList_create
  * Purpose:    to create a new empty linked list.
  * Parameters: None.
@@ -41,12 +58,12 @@ void LinkedList_destroy(LinkedList* l)
  *             into an internal structure containing meta data.
  * Parameters: l [IN]:       A pointer to the list's meta data structure,
  *             p [CONST IN]: The payload.
- * Returns:    0 in case of success, -1 otherwise (usually kmalloc failed). */
+ * Returns:    0 in case of success, -1 otherwise (usually no memory left). */
 int LinkedList_append(LinkedList* l, const void* p)
 {
 	if (l)
 	{
-		LinkedList_element* e = kmalloc(sizeof(LinkedList_element));
+		LinkedList_element* e = ObjectCache_allocate(LinkedList_elementCache);
 
 		if (e)
 		{
@@ -93,7 +110,7 @@ const void* LinkedList_popFront(LinkedList* l)
 		if (!l->first)
 			l->last = l->first;
 
-		kfree (e);
+		ObjectCache_free(LinkedList_elementCache, e);
 
 		return p;
 	}
@@ -1,7 +1,19 @@
 /* Memory management. Provides dynamically allocatable memory.
  *
  * Some of the functions herein are called from assembly wrappers who handle
- * disabling of interrupts to make the functions atomic. */
+ * disabling of interrupts to make the functions atomic. kmalloc and kfree
+ * disable interrupts themselves. Since interrupt handlers allocate, no
+ * function called with interrupts disabled loops over blocks; see
+ * MemoryManagement.h for how the two-level segregated fit heap works.
+ *
+ * kfree called with interrupts disabled, e.g. from an interrupt handler,
+ * only queues the block. Queued blocks are freed later with interrupts
+ * enabled, one at a time, by MemoryManagement_drainDeferred, which kfree
+ * calls when interrupts are enabled.
+ *
+ * Each region added to the pool starts with a free block and ends with a
+ * sentinel block of size 0 that is never free, so the physically next block
+ * always exists. */
 
 #include "stdio.h"
 #include "stdint.h"
@@ -9,121 +21,305 @@
 #include "Kernel_SystemMemoryMap.h"
 #include "io.h"
 
-/* Pointer to the first entry of the doubly linked list */
-static MemoryManagement_regionHeader* MemoryManagement_base = NULL;
+/* Bitmap of first level lists with at least one non-empty second level
+ * list, and bitmaps of the non-empty second level lists */
+static uint32_t MemoryManagement_flBitmap = 0;
+static uint32_t MemoryManagement_slBitmap[MEMORY_MANAGEMENT_FL_COUNT];
+
+/* Heads of the segregated free lists */
+static MemoryManagement_blockHeader* MemoryManagement_freeLists
+	[MEMORY_MANAGEMENT_FL_COUNT][MEMORY_MANAGEMENT_SL_COUNT];
+
+/* Statistics, kept up to date so they can be queried in constant time */
+static uint32_t MemoryManagement_totalMemory = 0;
+static uint32_t MemoryManagement_freeMemory = 0;
+
+/* Blocks freed with interrupts disabled, linked through nextFree */
+static MemoryManagement_blockHeader* MemoryManagement_deferred = NULL;
+static uint32_t MemoryManagement_deferredFrees = 0;
+
+#ifdef MEMORY_MANAGEMENT_PROFILE
+/* Call sites hashed by return address. The last entry collects the sites
+ * that do not fit. */
+static MemoryManagement_profileSite MemoryManagement_profileSites
+	[MEMORY_MANAGEMENT_PROFILE_SITES + 1];
+
+/* Longest time kmalloc and kfree kept interrupts disabled */
+static uint32_t MemoryManagement_maxMaskedCycles = 0;
+#endif
 
 /* Prototypes for static functions */
-static void MemoryManagement_append(MemoryManagement_regionHeader* r);
-static void MemoryManagement_assertHeaderIsValid(MemoryManagement_regionHeader* r);
+static void* MemoryManagement_allocateBlock(size_t size);
+static void MemoryManagement_freeBlock(void* pmem);
+static void MemoryManagement_defer(void* pmem);
+static inline uint32_t MemoryManagement_blockSize(MemoryManagement_blockHeader* b);
+static inline MemoryManagement_blockHeader* MemoryManagement_nextPhysical(MemoryManagement_blockHeader* b);
+static inline void MemoryManagement_mapping(uint32_t size, int* fl, int* sl);
+static void MemoryManagement_insert(MemoryManagement_blockHeader* b);
+static void MemoryManagement_remove(MemoryManagement_blockHeader* b);
+static void MemoryManagement_assertHeaderIsValid(MemoryManagement_blockHeader* b);
+#ifdef MEMORY_MANAGEMENT_PROFILE
+static void MemoryManagement_profileAllocated(MemoryManagement_blockHeader* b, void* caller);
+static void MemoryManagement_profileFreed(MemoryManagement_blockHeader* b);
+static void MemoryManagement_printProfile(void);
+static inline void MemoryManagement_profileMasked(uint64_t start);
+#endif
 
 /* Function:   MemoryManagement_allocate
  * Purpose:    to allocate a block of memory from the available memory pool.
- * Atomicity:  Called from assembly wrapper
+ * Atomicity:  Disables interrupts for one constant time heap operation
  * Parameters: size [IN]: Size of memory block
  * Returns:    Pointer to the allocated block of memory or NULL in case of
  *             failure (no free memory left). */
-__attribute__((cdecl)) void* c_MemoryManagement_allocate(size_t size)
+__attribute__((cdecl)) void* MemoryManagement_allocate(size_t size)
 {
-	/* Find a free region that is big enough */
-	MemoryManagement_regionHeader* r = MemoryManagement_base;
+	uint32_t eflags = kInterruptsDisable();
+
+#ifdef MEMORY_MANAGEMENT_PROFILE
+	uint64_t start = rdtsc();
+#endif
+
+	void* pmem = MemoryManagement_allocateBlock(size);
+
+#ifdef MEMORY_MANAGEMENT_PROFILE
+	if (pmem)
+		MemoryManagement_profileAllocated((MemoryManagement_blockHeader*)
+			((uint8_t*) pmem - MEMORY_MANAGEMENT_BLOCK_OVERHEAD),
+			__builtin_return_address(0));
 
-	while (r)
+	MemoryManagement_profileMasked(start);
+#endif
+
+	kInterruptsRestore(eflags);
+
+	/* Queued blocks may make the difference */
+	if (!pmem && (eflags & EFLAGS_IF) && MemoryManagement_deferred)
 	{
-		/* Check magic number */
-		MemoryManagement_assertHeaderIsValid(r);
+		MemoryManagement_drainDeferred();
+		pmem = MemoryManagement_allocate(size);
+	}
 
-		if (r->type == MEMORY_MANAGEMENT_REGION_FREE && r->size >= size)
-		{
-			/* Is it enough space to split the block? */
-			if (r->size > size + sizeof(MemoryManagement_regionHeader))
-			{
-				MemoryManagement_regionHeader* n =
-					(MemoryManagement_regionHeader*) ((uint8_t *) r + sizeof(*r) + size);
+	return pmem;
+}
+
+/* Function:   MemoryManagement_free
+ * Purpose:    to return a block of memory to the pool of available memory,
+ *             commonly known as freeing memory. If interrupts are disabled,
+ *             the block is queued to be freed later.
+ * Atomicity:  Disables interrupts for one constant time heap operation
+ * Parameters: pmem [IN]: Pointer to the begin of the memory block. */
+__attribute__((cdecl)) void MemoryManagement_free(void* pmem)
+{
+	if (!pmem)
+	{
+		printf("MemoryManagement: Trying to free a NULL pointer.\n");
+		kHUP();
+	}
 
-				n->type = r->type;
-				n->magic = 0x12345678;
-				n->size = r->size - sizeof(*n) - size;
+	uint32_t eflags = kInterruptsDisable();
 
-				/* Insert new header */
-				n->next = r->next;
-				n->previous = r;
+#ifdef MEMORY_MANAGEMENT_PROFILE
+	uint64_t start = rdtsc();
+#endif
 
-				r->next = n;
+	if (eflags & EFLAGS_IF)
+		MemoryManagement_freeBlock(pmem);
+	else
+		MemoryManagement_defer(pmem);
 
-				if (n->next)
-					n->next->previous = n;
+#ifdef MEMORY_MANAGEMENT_PROFILE
+	MemoryManagement_profileMasked(start);
+#endif
 
-				/* Adjust size of r */
-				r->size = size;
-			}
+	kInterruptsRestore(eflags);
 
-			/* Occupy region */
-			r->type = MEMORY_MANAGEMENT_REGION_OCCUPIED;
-			return r + 1;
-		}
-		r = r->next;
+	if ((eflags & EFLAGS_IF) && MemoryManagement_deferred)
+		MemoryManagement_drainDeferred();
+}
+
+/* Function:   MemoryManagement_drainDeferred
+ * Purpose:    to free the blocks queued by kfree while interrupts were
+ *             disabled. Does nothing if interrupts are disabled.
+ * Atomicity:  Disables interrupts for one constant time heap operation at a
+ *             time
+ * Parameters: None. */
+void MemoryManagement_drainDeferred(void)
+{
+	uint32_t eflags = kInterruptsDisable();
+	MemoryManagement_blockHeader* b = NULL;
+
+	/* Take the whole queue */
+	if (eflags & EFLAGS_IF)
+	{
+		b = MemoryManagement_deferred;
+		MemoryManagement_deferred = NULL;
 	}
 
-	return NULL;
+	kInterruptsRestore(eflags);
+
+	while (b)
+	{
+		MemoryManagement_blockHeader* next = b->nextFree;
+
+		eflags = kInterruptsDisable();
+
+		b->size &= ~MEMORY_MANAGEMENT_BLOCK_DEFERRED;
+		MemoryManagement_freeBlock((uint8_t*) b + MEMORY_MANAGEMENT_BLOCK_OVERHEAD);
+
+		kInterruptsRestore(eflags);
+
+		b = next;
+	}
 }
 
-/* Function:   MemoryManagement_free
- * Purpose:    to return a block of memory to the pool of available memory,
- *             commonly known as freeing memory.
- * Atomicity:  Called from assembly wrapper
+/* Function:   MemoryManagement_allocateBlock
+ * Purpose:    to allocate a block of memory from the segregated free lists.
+ * Atomicity:  Called with interrupts disabled (internal helper)
+ * Parameters: size [IN]: Size of memory block
+ * Returns:    Pointer to the allocated block of memory or NULL in case of
+ *             failure (no free memory left). */
+static void* MemoryManagement_allocateBlock(size_t size)
+{
+	if (size > MEMORY_MANAGEMENT_MAX_SIZE)
+		return NULL;
+
+	/* The payload must hold the free list links once it is freed */
+	if (size < MEMORY_MANAGEMENT_MIN_BLOCK_SIZE)
+		size = MEMORY_MANAGEMENT_MIN_BLOCK_SIZE;
+
+	size = (size + MEMORY_MANAGEMENT_ALIGNMENT - 1) &
+		~(MEMORY_MANAGEMENT_ALIGNMENT - 1);
+
+	/* Round the size up to the next list boundary, so any block in the
+	 * list found is big enough */
+	uint32_t searchSize = size;
+
+	if (searchSize >= MEMORY_MANAGEMENT_SMALL_SIZE)
+		searchSize += (1U << (31 - __builtin_clz(searchSize) -
+			MEMORY_MANAGEMENT_SL_LOG2)) - 1;
+
+	int fl, sl;
+	MemoryManagement_mapping(searchSize, &fl, &sl);
+
+	/* Find a non-empty list of that size or, failing that, of the next
+	 * larger size */
+	uint32_t slMap = MemoryManagement_slBitmap[fl] & (~0U << sl);
+
+	if (!slMap)
+	{
+		uint32_t flMap = fl + 1 < MEMORY_MANAGEMENT_FL_COUNT ?
+			MemoryManagement_flBitmap & (~0U << (fl + 1)) : 0;
+
+		if (!flMap)
+			return NULL;
+
+		fl = __builtin_ctz(flMap);
+		slMap = MemoryManagement_slBitmap[fl];
+	}
+
+	sl = __builtin_ctz(slMap);
+
+	MemoryManagement_blockHeader* b = MemoryManagement_freeLists[fl][sl];
+
+	MemoryManagement_assertHeaderIsValid(b);
+	MemoryManagement_remove(b);
+
+	MemoryManagement_blockHeader* next = MemoryManagement_nextPhysical(b);
+	uint32_t blockSize = MemoryManagement_blockSize(b);
+
+	/* Is it enough space to split the block? */
+	if (blockSize >= size + MEMORY_MANAGEMENT_BLOCK_OVERHEAD +
+		MEMORY_MANAGEMENT_MIN_BLOCK_SIZE)
+	{
+		MemoryManagement_blockHeader* n = (MemoryManagement_blockHeader*)
+			((uint8_t*) b + MEMORY_MANAGEMENT_BLOCK_OVERHEAD + size);
+
+		n->previousPhysical = b;
+		n->size = (blockSize - size - MEMORY_MANAGEMENT_BLOCK_OVERHEAD) |
+			MEMORY_MANAGEMENT_BLOCK_FREE;
+		n->magic = MEMORY_MANAGEMENT_MAGIC;
+
+		next->previousPhysical = n;
+
+		MemoryManagement_insert(n);
+
+		b->size = size | (b->size & MEMORY_MANAGEMENT_BLOCK_PREVIOUS_FREE);
+	}
+	else
+	{
+		next->size &= ~MEMORY_MANAGEMENT_BLOCK_PREVIOUS_FREE;
+	}
+
+	/* Occupy block */
+	b->size &= ~MEMORY_MANAGEMENT_BLOCK_FREE;
+
+	return (uint8_t*) b + MEMORY_MANAGEMENT_BLOCK_OVERHEAD;
+}
+
+/* Function:   MemoryManagement_freeBlock
+ * Purpose:    to return a block of memory to the segregated free lists and
+ *             merge it with its free neighbours.
+ * Atomicity:  Called with interrupts disabled (internal helper)
  * Parameters: pmem [IN]: Pointer to the begin of the memory block. */
-__attribute__((cdecl)) void c_MemoryManagement_free(void* pmem)
+static void MemoryManagement_freeBlock(void* pmem)
 {
 	if (pmem)
 	{
-		MemoryManagement_regionHeader *r = (MemoryManagement_regionHeader*) pmem - 1;
+		MemoryManagement_blockHeader* b = (MemoryManagement_blockHeader*)
+			((uint8_t*) pmem - MEMORY_MANAGEMENT_BLOCK_OVERHEAD);
 
-		if (r->type != MEMORY_MANAGEMENT_REGION_OCCUPIED ||
-			r->magic != 0x12345678)
+		if ((b->size & (MEMORY_MANAGEMENT_BLOCK_FREE |
+			MEMORY_MANAGEMENT_BLOCK_DEFERRED)) ||
+			b->magic != MEMORY_MANAGEMENT_MAGIC)
 		{
 			printf("MemoryManagement: Double free or corruption.\n");
 			kHUP();
 		}
 		else
 		{
-			/* Free block */
-			r->type = MEMORY_MANAGEMENT_REGION_FREE;
+#ifdef MEMORY_MANAGEMENT_PROFILE
+			MemoryManagement_profileFreed(b);
+#endif
 
-			/* Merge with possibly touching and free lower neighbour */
-			if (r->previous && r->previous->type == MEMORY_MANAGEMENT_REGION_FREE)
+			/* Merge with the lower neighbour if it is free */
+			if (b->size & MEMORY_MANAGEMENT_BLOCK_PREVIOUS_FREE)
 			{
-				if ((uint8_t*) r->previous +
-					sizeof(MemoryManagement_regionHeader) +
-					r->previous->size == (uint8_t*) r)
-				{
-					/* The headers are in touch */
-					r->previous->size += r->size +
-						sizeof(MemoryManagement_regionHeader);
-
-					r->previous->next = r->next;
-					if (r->next)
-						r->next->previous = r->previous;
-
-					r = r->previous;
-				}
+				MemoryManagement_blockHeader* p = b->previousPhysical;
+
+				MemoryManagement_assertHeaderIsValid(p);
+				MemoryManagement_remove(p);
+
+				p->size += MEMORY_MANAGEMENT_BLOCK_OVERHEAD +
+					MemoryManagement_blockSize(b);
+
+				/* Catch frees of the merged block */
+				b->magic = 0;
+				b = p;
 			}
 
-			/* Merge with possibly touching and free upper neighbour */
-			if (r->next && r->next->type == MEMORY_MANAGEMENT_REGION_FREE)
+			/* Merge with the upper neighbour if it is free */
+			MemoryManagement_blockHeader* n = MemoryManagement_nextPhysical(b);
+
+			MemoryManagement_assertHeaderIsValid(n);
+
+			if (n->size & MEMORY_MANAGEMENT_BLOCK_FREE)
 			{
-				if ((uint8_t*) r +
-					sizeof(MemoryManagement_regionHeader) +
-					r->size == (uint8_t*) r->next)
-				{
-					/* The headers are in touch */
-					r->size += r->next->size +
-						sizeof(MemoryManagement_regionHeader);
-
-					r->next = r->next->next;
-					if (r->next)
-						r->next->previous = r;
-				}
+				MemoryManagement_remove(n);
+
+				b->size += MEMORY_MANAGEMENT_BLOCK_OVERHEAD +
+					MemoryManagement_blockSize(n);
+
+				n->magic = 0;
+				n = MemoryManagement_nextPhysical(b);
 			}
+
+			/* Free block and set the upper neighbour's boundary tag */
+			b->size |= MEMORY_MANAGEMENT_BLOCK_FREE;
+
+			n->previousPhysical = b;
+			n->size |= MEMORY_MANAGEMENT_BLOCK_PREVIOUS_FREE;
+
+			MemoryManagement_insert(b);
 		}
 	}
 	else
@@ -133,24 +329,40 @@ __attribute__((cdecl)) void c_MemoryManagement_free(void* pmem)
 	}
 }
 
+/* Function:   MemoryManagement_defer
+ * Purpose:    to queue a block to be freed once interrupts are enabled.
+ * Atomicity:  Called with interrupts disabled (internal helper)
+ * Parameters: pmem [IN]: Pointer to the begin of the memory block. */
+static void MemoryManagement_defer(void* pmem)
+{
+	MemoryManagement_blockHeader* b = (MemoryManagement_blockHeader*)
+		((uint8_t*) pmem - MEMORY_MANAGEMENT_BLOCK_OVERHEAD);
+
+	if ((b->size & (MEMORY_MANAGEMENT_BLOCK_FREE |
+		MEMORY_MANAGEMENT_BLOCK_DEFERRED)) ||
+		b->magic != MEMORY_MANAGEMENT_MAGIC)
+	{
+		printf("MemoryManagement: Double free or corruption.\n");
+		kHUP();
+	}
+
+	/* The payload is not used anymore */
+	b->size |= MEMORY_MANAGEMENT_BLOCK_DEFERRED;
+	b->nextFree = MemoryManagement_deferred;
+	MemoryManagement_deferred = b;
+	MemoryManagement_deferredFrees++;
+}
+
 /* Function:   MemoryManagement_getTotalMemory
  * Purpose:    to query the amount of total available memory (sum of free and
- *             occupied. Useful for statistics.
+ *             occupied, including the headers of all but the first block of
+ *             each region). Useful for statistics.
  * Atomicity:  Called from assembly wrapper
  * Parameters: None.
  * Returns:    The total amount of available memory. */
 __attribute__((cdecl)) uint32_t c_MemoryManagement_getTotalMemory(void)
 {
-	uint32_t size = 0;
-	MemoryManagement_regionHeader* r = MemoryManagement_base;
-
-	while (r)
-	{
-		size += r->size;
-		r = r->next;
-	}
-
-	return size;
+	return MemoryManagement_totalMemory;
 }
 
 /* Function:   MemoryManagement_getFreeMemory
@@ -160,18 +372,7 @@ __attribute__((cdecl)) uint32_t c_MemoryManagement_getTotalMemory(void)
  * Returns:    The amount of free memory. */
 __attribute__((cdecl)) uint32_t c_MemoryManagement_getFreeMemory(void)
 {
-	uint32_t size = 0;
-	MemoryManagement_regionHeader* r = MemoryManagement_base;
-
-	while (r)
-	{
-		if (r->type == MEMORY_MANAGEMENT_REGION_FREE)
-			size += r->size;
-
-		r = r->next;
-	}
-
-	return size;
+	return MemoryManagement_freeMemory;
 }
 
 /* Function:   MemoryManagement_addRegion
@@ -179,9 +380,9 @@ __attribute__((cdecl)) uint32_t c_MemoryManagement_getFreeMemory(void)
  *             A base address of 0 is not allowed to have a value for invalid
  *             pointers. If a base address of 0 is supplied, the region is not
  *             added. Additionally, the size available for allocation will be
- *             less than the supplied size by
- *             sizeof(MemoryManagement_regionHeader), because meta data has to
- *             be stored. If the supplied size is to small to provide any
+ *             less than the supplied size by two block headers and the
+ *             alignment of the base address, because meta data has to be
+ *             stored. If the supplied size is to small to provide any
  *             available memory, the region is not added.
  *             The region must be disjoint with the memory already available.
  * Atomicity:  Called from assembly wrapper
@@ -189,17 +390,40 @@ __attribute__((cdecl)) uint32_t c_MemoryManagement_getFreeMemory(void)
  *             size [IN]: The memory region's size */
 __attribute__((cdecl)) void c_MemoryManagement_addRegion(uint32_t base, uint32_t size)
 {
-	if (base != 0 && size > sizeof(MemoryManagement_regionHeader))
-	{
-		MemoryManagement_regionHeader* ph = (MemoryManagement_regionHeader*) base;
+	if (base == 0)
+		return;
 
-		/* Initialize header */
-		ph->size = size - sizeof (MemoryManagement_regionHeader);
-		ph->magic = 0x12345678;
-		ph->type = MEMORY_MANAGEMENT_REGION_FREE;
+	/* Align the region */
+	uint32_t start = (base + MEMORY_MANAGEMENT_ALIGNMENT - 1) &
+		~(MEMORY_MANAGEMENT_ALIGNMENT - 1);
 
-		MemoryManagement_append(ph);
-	}
+	if (start < base || start - base >= size)
+		return;
+
+	size = (size - (start - base)) & ~(MEMORY_MANAGEMENT_ALIGNMENT - 1);
+
+	if (size < 2 * MEMORY_MANAGEMENT_BLOCK_OVERHEAD +
+		MEMORY_MANAGEMENT_MIN_BLOCK_SIZE)
+		return;
+
+	/* Free block covering the region, which is not merged with anything in
+	 * front of it */
+	MemoryManagement_blockHeader* b = (MemoryManagement_blockHeader*) start;
+
+	b->previousPhysical = NULL;
+	b->size = (size - 2 * MEMORY_MANAGEMENT_BLOCK_OVERHEAD) |
+		MEMORY_MANAGEMENT_BLOCK_FREE;
+	b->magic = MEMORY_MANAGEMENT_MAGIC;
+
+	/* Sentinel at the region's end */
+	MemoryManagement_blockHeader* s = MemoryManagement_nextPhysical(b);
+
+	s->previousPhysical = b;
+	s->size = MEMORY_MANAGEMENT_BLOCK_PREVIOUS_FREE;
+	s->magic = MEMORY_MANAGEMENT_MAGIC;
+
+	MemoryManagement_totalMemory += MemoryManagement_blockSize(b);
+	MemoryManagement_insert(b);
 }
 
 /* Function:   MemoryManagement_addFromSMAP
@@ -221,93 +445,293 @@ void MemoryManagement_addFromSMAP(void)
 	}
 }
 
-/* Function:   MemoryManagement_append
- * Purpose:    to append a memory region to the current list. Use with care,
- *             no error checking is done.
+/* Function:   MemoryManagement_blockSize
+ * Purpose:    to get the size of a block's payload without the flags.
  * Atomicity:  Not required (internal helper)
- * Parameters: r [IN]: The memory region */
-static void MemoryManagement_append(MemoryManagement_regionHeader* r)
+ * Parameters: b [IN]: The block's header
+ * Returns:    The size of the payload. */
+static inline uint32_t MemoryManagement_blockSize(MemoryManagement_blockHeader* b)
 {
-	if (MemoryManagement_base)
-	{
-		MemoryManagement_regionHeader *last = MemoryManagement_base;
+	return b->size & ~MEMORY_MANAGEMENT_BLOCK_FLAGS;
+}
 
-		/* Find last element in list */
-		while (last->next)
-			last = last->next;
+/* Function:   MemoryManagement_nextPhysical
+ * Purpose:    to get the block physically following a block.
+ * Atomicity:  Not required (internal helper)
+ * Parameters: b [IN]: The block's header, which must not be a sentinel
+ * Returns:    The next block's header. */
+static inline MemoryManagement_blockHeader* MemoryManagement_nextPhysical(MemoryManagement_blockHeader* b)
+{
+	return (MemoryManagement_blockHeader*) ((uint8_t*) b +
+		MEMORY_MANAGEMENT_BLOCK_OVERHEAD + MemoryManagement_blockSize(b));
+}
 
-		last->next = r;
-		r->previous = last;
-		r->next = NULL;
+/* Function:   MemoryManagement_mapping
+ * Purpose:    to find the segregated list a block size belongs to.
+ * Atomicity:  Not required (internal helper)
+ * Parameters: size [IN]:  The block size
+ *             fl   [OUT]: The first level index
+ *             sl   [OUT]: The second level index */
+static inline void MemoryManagement_mapping(uint32_t size, int* fl, int* sl)
+{
+	if (size < MEMORY_MANAGEMENT_SMALL_SIZE)
+	{
+		*fl = 0;
+		*sl = size / (MEMORY_MANAGEMENT_SMALL_SIZE / MEMORY_MANAGEMENT_SL_COUNT);
 	}
 	else
 	{
-		r->next = r->previous = NULL;
-		MemoryManagement_base = r;
+		int msb = 31 - __builtin_clz(size);
+
+		*fl = msb - (MEMORY_MANAGEMENT_FL_SHIFT - 1);
+		*sl = (size >> (msb - MEMORY_MANAGEMENT_SL_LOG2)) ^
+			MEMORY_MANAGEMENT_SL_COUNT;
 	}
 }
 
+/* Function:   MemoryManagement_insert
+ * Purpose:    to insert a free block at the head of its segregated list.
+ * Atomicity:  Not required (internal helper)
+ * Parameters: b [IN]: The block's header */
+static void MemoryManagement_insert(MemoryManagement_blockHeader* b)
+{
+	int fl, sl;
+	MemoryManagement_mapping(MemoryManagement_blockSize(b), &fl, &sl);
+
+	MemoryManagement_blockHeader* head = MemoryManagement_freeLists[fl][sl];
+
+	b->previousFree = NULL;
+	b->nextFree = head;
+
+	if (head)
+		head->previousFree = b;
+
+	MemoryManagement_freeLists[fl][sl] = b;
+	MemoryManagement_flBitmap |= 1U << fl;
+	MemoryManagement_slBitmap[fl] |= 1U << sl;
+
+	MemoryManagement_freeMemory += MemoryManagement_blockSize(b);
+}
+
+/* Function:   MemoryManagement_remove
+ * Purpose:    to remove a free block from its segregated list.
+ * Atomicity:  Not required (internal helper)
+ * Parameters: b [IN]: The block's header */
+static void MemoryManagement_remove(MemoryManagement_blockHeader* b)
+{
+	int fl, sl;
+	MemoryManagement_mapping(MemoryManagement_blockSize(b), &fl, &sl);
+
+	if (b->previousFree)
+		b->previousFree->nextFree = b->nextFree;
+	else
+		MemoryManagement_freeLists[fl][sl] = b->nextFree;
+
+	if (b->nextFree)
+		b->nextFree->previousFree = b->previousFree;
+
+	/* Clear the bitmaps if the list became empty */
+	if (!MemoryManagement_freeLists[fl][sl])
+	{
+		MemoryManagement_slBitmap[fl] &= ~(1U << sl);
+
+		if (!MemoryManagement_slBitmap[fl])
+			MemoryManagement_flBitmap &= ~(1U << fl);
+	}
+
+	MemoryManagement_freeMemory -= MemoryManagement_blockSize(b);
+}
+
 /* Function:   MemoryManagement_assertHeaderIsValid
- * Purpose:    to ensure that a region header is valid.
+ * Purpose:    to ensure that a block header is valid.
  *             Helper function.
  * Atomicity:  Not required (internal helper)
- * Parameters: r [IN]: Pointer to region header. */
-static void MemoryManagement_assertHeaderIsValid(MemoryManagement_regionHeader* r)
+ * Parameters: b [IN]: Pointer to block header. */
+static void MemoryManagement_assertHeaderIsValid(MemoryManagement_blockHeader* b)
 {
-	if (!r)
+	if (!b)
 	{
-		printf("MemoryManagement: region header NULL\n");
+		printf("MemoryManagement: block header NULL\n");
 		kHUP();
 	}
 
-	if (r->magic != 0x12345678)
+	if (b->magic != MEMORY_MANAGEMENT_MAGIC)
 	{
-		printf("MemoryManagement: region magic number invalid\n");
+		printf("MemoryManagement: block magic number invalid\n");
 		kHUP();
 	}
 }
 
 /* Function:   MemoryManagement_print
- * Purpose:    to print the current memory region list, useful for debugging.
+ * Purpose:    to print the segregated free lists, useful for debugging.
  * Atomicity:  Called from assembly wrapper
  * Parameters: None. */
 __attribute__((cdecl)) void c_MemoryManagement_print(void)
 {
-	printf("****************************** Memory Region List *****************************\n"
-		"Base: %p\n", MemoryManagement_base);
+	printf("******************************* Free Block Lists ******************************\n"
+		"Total: %xh, free: %xh, first level bitmap: %xh, deferred frees: %d%s\n",
+		MemoryManagement_totalMemory,
+		MemoryManagement_freeMemory,
+		MemoryManagement_flBitmap,
+		(int) MemoryManagement_deferredFrees,
+		MemoryManagement_deferred ? " (pending)" : "");
+
+	for (int fl = 0; fl < MEMORY_MANAGEMENT_FL_COUNT; fl++)
+	{
+		for (int sl = 0; sl < MEMORY_MANAGEMENT_SL_COUNT; sl++)
+		{
+			MemoryManagement_blockHeader* b = MemoryManagement_freeLists[fl][sl];
+
+			if (b)
+				printf("List %d/%d:\n", fl, sl);
+
+			while (b)
+			{
+				printf("Header addr: %p, .previousFree: %p, .nextFree: %p,\n"
+					"    .size: %xh, .magic: %s, .previousPhysical: %p\n",
+					b,
+					b->previousFree,
+					b->nextFree,
+					MemoryManagement_blockSize(b),
+					b->magic == MEMORY_MANAGEMENT_MAGIC ? "[ OK ]" : "[FAIL]",
+					(b->size & MEMORY_MANAGEMENT_BLOCK_PREVIOUS_FREE) ?
+						b->previousPhysical : NULL);
+
+				b = b->nextFree;
+			}
+		}
+	}
+
+	printf("--- end ---\n\n");
+
+#ifdef MEMORY_MANAGEMENT_PROFILE
+	MemoryManagement_printProfile();
+#endif
+}
 
-	MemoryManagement_regionHeader* r = MemoryManagement_base;
+#ifdef MEMORY_MANAGEMENT_PROFILE
+/* Function:   MemoryManagement_profileAllocated
+ * Purpose:    to account an allocated block to its call site.
+ * Atomicity:  Called with interrupts disabled (internal helper)
+ * Parameters: b      [IN]: The allocated block's header
+ *             caller [IN]: Return address of the kmalloc call */
+static void MemoryManagement_profileAllocated(MemoryManagement_blockHeader* b, void* caller)
+{
+	/* Fibonacci hashing of the return address */
+	uint32_t index = ((uint32_t) (uintptr_t) caller * 2654435761U) >> 26;
+	uint32_t probes;
 
-	while (r != NULL)
+	for (probes = 0; probes < MEMORY_MANAGEMENT_PROFILE_SITES; probes++)
 	{
-		const char* stype;
+		MemoryManagement_profileSite* s = &MemoryManagement_profileSites[index];
+
+		if (s->caller == caller)
+			break;
 
-		switch (r->type)
+		if (!s->caller)
 		{
-			case MEMORY_MANAGEMENT_REGION_FREE:
-				stype = "[   free   ]";
-				break;
+			s->caller = caller;
+			s->firstSeen = rdtsc();
+			break;
+		}
 
-			case MEMORY_MANAGEMENT_REGION_OCCUPIED:
-				stype = "[ occupied ]";
-				break;
+		index = (index + 1) & (MEMORY_MANAGEMENT_PROFILE_SITES - 1);
+	}
+
+	if (probes == MEMORY_MANAGEMENT_PROFILE_SITES)
+		index = MEMORY_MANAGEMENT_PROFILE_SITES;
+
+	MemoryManagement_profileSite* s = &MemoryManagement_profileSites[index];
 
-			default:
-				stype = "[undefined ]";
-				break;
+	s->allocations++;
+	s->liveBytes += MemoryManagement_blockSize(b);
+
+	if (s->liveBytes > s->peakLiveBytes)
+		s->peakLiveBytes = s->liveBytes;
+
+	b->site = index;
+}
+
+/* Function:   MemoryManagement_profileFreed
+ * Purpose:    to account a freed block to the call site that allocated it.
+ * Atomicity:  Called with interrupts disabled (internal helper)
+ * Parameters: b [IN]: The block's header, before it is merged */
+static void MemoryManagement_profileFreed(MemoryManagement_blockHeader* b)
+{
+	MemoryManagement_profileSite* s = &MemoryManagement_profileSites[b->site];
+
+	s->frees++;
+	s->liveBytes -= MemoryManagement_blockSize(b);
+}
+
+/* Function:   MemoryManagement_profileMasked
+ * Purpose:    to record how long kmalloc or kfree kept interrupts disabled.
+ * Atomicity:  Called with interrupts disabled (internal helper)
+ * Parameters: start [IN]: TSC after disabling interrupts */
+static inline void MemoryManagement_profileMasked(uint64_t start)
+{
+	uint32_t cycles = rdtsc() - start;
+
+	if (cycles > MemoryManagement_maxMaskedCycles)
+		MemoryManagement_maxMaskedCycles = cycles;
+}
+
+/* Function:   MemoryManagement_printProfile
+ * Purpose:    to print the call sites with the most live bytes, ties broken
+ *             by the number of allocations.
+ * Atomicity:  Called with interrupts disabled (internal helper)
+ * Parameters: None. */
+static void MemoryManagement_printProfile(void)
+{
+	uint8_t printed[MEMORY_MANAGEMENT_PROFILE_SITES + 1] = {0};
+	uint64_t now = rdtsc();
+
+	printf("**************************** Allocation Profile *******************************\n"
+		"Longest time with interrupts disabled: %d cycles\n",
+		(int) MemoryManagement_maxMaskedCycles);
+
+	for (int n = 0; n < MEMORY_MANAGEMENT_PROFILE_TOP; n++)
+	{
+		MemoryManagement_profileSite* best = NULL;
+		int bestIndex = 0;
+
+		for (int i = 0; i <= MEMORY_MANAGEMENT_PROFILE_SITES; i++)
+		{
+			MemoryManagement_profileSite* s = &MemoryManagement_profileSites[i];
+
+			if (printed[i] || s->allocations == 0)
+				continue;
+
+			if (!best || s->liveBytes > best->liveBytes ||
+				(s->liveBytes == best->liveBytes &&
+				 s->allocations > best->allocations))
+			{
+				best = s;
+				bestIndex = i;
+			}
 		}
 
-		printf("Header addr: %p, .previous: %p, .next: %p,\n"
-			"    .size: %xh, .magic: %s, .type: %s\n",
-			r,
-			r->previous,
-			r->next,
-			r->size,
-			r->magic == 0x12345678 ? "[ OK ]" : "[FAIL]",
-			stype);
+		if (!best)
+			break;
+
+		printed[bestIndex] = 1;
+
+		/* Allocations per million cycles since the site's first one */
+		uint32_t rate = 0;
+
+		if (now > best->firstSeen)
+			rate = best->allocations * 1000000ULL / (now - best->firstSeen);
 
-		r = r->next;
+		printf("Caller: %p, live: %xh (peak %xh), allocations: %d, frees: %d,\n"
+			"    rate: %d/Mcycle\n",
+			best->caller,
+			best->liveBytes,
+			best->peakLiveBytes,
+			(int) best->allocations,
+			(int) best->frees,
+			(int) rate);
 	}
 
 	printf("--- end ---\n\n");
 }
+#endif
@@ -3,56 +3,6 @@
 bits 32
 section .text
 
-global MemoryManagement_allocate
-MemoryManagement_allocate:
-	push ebp
-	mov ebp, esp
-
-	; Push EFLAGS and disable interrupts
-	pushfd
-	cli
-
-	mov eax, [ebp + 8]
-	push eax
-
-	; Stack alignment should be fine: 3 push and call
-	extern c_MemoryManagement_allocate
-	call c_MemoryManagement_allocate
-
-	; Clean stack
-	add esp, 4
-
-	; Restore EFLAGS
-	popfd
-
-	pop ebp
-	ret
-
-global MemoryManagement_free
-MemoryManagement_free:
-	push ebp
-	mov ebp, esp
-
-	; Push EFLAGS and disable interrupts
-	pushfd
-	cli
-
-	mov eax, [ebp + 8]
-	push eax
-
-	; Stack alignment should be fine: 3 push and call
-	extern c_MemoryManagement_free
-	call c_MemoryManagement_free
-
-	; Clean stack
-	add esp, 4
-
-	; Restore EFLAGS
-	popfd
-
-	pop ebp
-	ret
-
 global MemoryManagement_addRegion
 MemoryManagement_addRegion:
 	push ebp
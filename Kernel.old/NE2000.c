@@ -144,78 +144,68 @@ __attribute__((cdecl)) void c_NE2000_isr_handler(void)
 
 		uint16_t recvCnt = inw(iobase + NE_FIFO);
 
-		if (recvCnt >= 64)
+		/* We don't need the CRC, the card already checked it. */
+		uint16_t dataSize = recvCnt - (6 + 6 + 2 + 4);
+
+		if (recvCnt >= 64 && dataSize <= ETHERNET_MAX_DATA_SIZE)
 		{
-			ethernet2_packet* pkt = kmalloc(sizeof(ethernet2_packet));
+			ethernet2_packet* pkt = ethernet_allocatePacket(dataSize);
 			if (pkt)
 			{
-				bzero(pkt, sizeof(*pkt));
+				/* Destination MAC address */
+				for (uint8_t i = 0; i < 3; i++)
+				{
+					((uint16_t*) pkt->macDestination)[i] = inw(iobase + NE_FIFO);
+				}
+
+				/* Source MAC address */
+				for (uint8_t i = 0; i < 3; i++)
+				{
+					((uint16_t*) pkt->macSource)[i] = inw(iobase + NE_FIFO);
+				}
 
-				/* We don't need the CRC, the card already checked it. */
-				pkt->dataSize = recvCnt - (6 + 6 + 2 + 4);
 
-				pkt->data = kmalloc(pkt->dataSize);
-				if (pkt->data)
+				/* Type field */
+				pkt->type = ethernet_ntohs(inw(iobase + NE_FIFO));
+				if (pkt->type > 0x600)
 				{
-					/* Destination MAC address */
-					for (uint8_t i = 0; i < 3; i++)
+					for (uint16_t i = 0; i < pkt->dataSize / 2; i++)
 					{
-						((uint16_t*) pkt->macDestination)[i] = inw(iobase + NE_FIFO);
+						((uint16_t*) pkt->data)[i] = inw(iobase + NE_FIFO);
 					}
 
-					/* Source MAC address */
-					for (uint8_t i = 0; i < 3; i++)
+					/* Odd packet length */
+					if (pkt->dataSize & 0x01)
 					{
-						((uint16_t*) pkt->macSource)[i] = inw(iobase + NE_FIFO);
+						pkt->data[pkt->dataSize - 1] = inb(iobase + NE_FIFO);
 					}
 
-
-					/* Type field */
-					pkt->type = ethernet_ntohs(inw(iobase + NE_FIFO));
-					if (pkt->type > 0x600)
+					/* Enqueue the packet. */
+					if (LinkedQueue_enqueue(ne->recvQueue, pkt) < 0)
 					{
-						for (uint16_t i = 0; i < pkt->dataSize / 2; i++)
-						{
-							((uint16_t*) pkt->data)[i] = inw(iobase + NE_FIFO);
-						}
-
-						/* Odd packet length */
-						if (pkt->dataSize & 0x01)
-						{
-							pkt->data[pkt->dataSize - 1] = inb(iobase + NE_FIFO);
-						}
-
-						/* Enqueue the packet. */
-						if (LinkedQueue_enqueue(ne->recvQueue, pkt) < 0)
-						{
-							kfree (pkt->data);
-							kfree(pkt);
-							printf ("NE2000: Enqueuing packet failed.\n");
-						}
+						ethernet_freePacket(pkt);
+						printf ("NE2000: Enqueuing packet failed.\n");
 					}
-					else
-					{
-						kfree(pkt->data);
-						kfree(pkt);
-						printf ("NE2000: Received an Ethernet-I frame (not supported).\n");
-					}
-
 				}
 				else
 				{
-					kfree(pkt);
-					printf("NE2000: Allocating buffer for packet data failed.\n");
+					ethernet_freePacket(pkt);
+					printf ("NE2000: Received an Ethernet-I frame (not supported).\n");
 				}
 			}
 			else
 			{
-				printf("NE2000: Allocating packet meta-data-structure failed.\n");
+				printf("NE2000: Allocating packet failed.\n");
 			}
 		}
-		else
+		else if (recvCnt < 64)
 		{
 			printf("NE2000: Runt packet received.\n");
 		}
+		else
+		{
+			printf("NE2000: Oversized packet received.\n");
+		}
 
 		NE2000_remoteDMA_stop(ne);
 
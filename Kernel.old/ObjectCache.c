@@ -0,0 +1,286 @@
+/* Object caches. Provide fixed size objects from slabs with a free list per
+ * cache.
+ *
+ * ObjectCache_allocate and ObjectCache_free disable interrupts for the free
+ * list operation only. New slabs are built with interrupts enabled unless the
+ * caller has them disabled. */
+
+#include "stdio.h"
+#include "string.h"
+#include "io.h"
+#include "ObjectCache.h"
+
+/* Prototypes for static functions */
+static ObjectCache_slab* ObjectCache_buildSlab(ObjectCache* cache,
+	void** last);
+static void ObjectCache_addSlab(ObjectCache* cache, ObjectCache_slab* s,
+	void* last);
+
+/* Function:   ObjectCache_create
+ * Purpose:    to create an empty object cache.
+ * Parameters: name        [IN]: Name of the cache, for statistics. It is not
+ *                               copied.
+ *             objectSize  [IN]: Size of the objects
+ *             alignment   [IN]: Alignment of the objects, a power of 2 or 0
+ *                               for the heap's alignment
+ *             constructor [IN]: Function to initialize new objects or NULL
+ * Returns:    A pointer to the new cache or NULL in case of failure (invalid
+ *             parameters or kmalloc failed). */
+ObjectCache* ObjectCache_create(const char* name, uint32_t objectSize,
+	uint32_t alignment, ObjectCache_constructor constructor)
+{
+	if (alignment == 0)
+		alignment = MEMORY_MANAGEMENT_ALIGNMENT;
+
+	if (objectSize == 0 || objectSize > OBJECT_CACHE_SLAB_SIZE ||
+		(alignment & (alignment - 1)))
+		return NULL;
+
+	ObjectCache* cache = kmalloc(sizeof(ObjectCache));
+
+	if (cache)
+	{
+		bzero(cache, sizeof(ObjectCache));
+
+		cache->name = name;
+		cache->objectSize = objectSize;
+		cache->alignment = alignment;
+		cache->constructor = constructor;
+
+		/* Free objects link to the next one at linkOffset */
+		uint32_t stride = objectSize;
+
+		if (constructor)
+		{
+			stride = (stride + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+			cache->linkOffset = stride;
+			stride += sizeof(void*);
+		}
+
+		if (alignment < sizeof(void*))
+			alignment = sizeof(void*);
+
+		cache->stride = (stride + alignment - 1) & ~(alignment - 1);
+
+		cache->objectsPerSlab = OBJECT_CACHE_SLAB_SIZE / cache->stride;
+
+		if (cache->objectsPerSlab < OBJECT_CACHE_MIN_OBJECTS)
+			cache->objectsPerSlab = OBJECT_CACHE_MIN_OBJECTS;
+	}
+
+	return cache;
+}
+
+/* Function:   ObjectCache_destroy
+ * Purpose:    to destroy an object cache and return its slabs to the heap.
+ *             All objects must have been freed, otherwise the cache is not
+ *             destroyed.
+ * Parameters: cache [IN]: The cache to destroy. */
+void ObjectCache_destroy(ObjectCache* cache)
+{
+	if (cache)
+	{
+		if (cache->inUse)
+		{
+			printf("ObjectCache: Destroying cache %s with %d objects in use.\n",
+				cache->name, (int) cache->inUse);
+			return;
+		}
+
+		ObjectCache_slab* s = cache->slabs;
+
+		while (s)
+		{
+			ObjectCache_slab* next = s->next;
+
+			kfree(s);
+			s = next;
+		}
+
+		kfree(cache);
+	}
+}
+
+/* Function:   ObjectCache_allocate
+ * Purpose:    to allocate an object from a cache. If the cache has no free
+ *             objects, a slab is allocated from the heap.
+ * Atomicity:  Disables interrupts for the free list operation
+ * Parameters: cache [IN]: The cache
+ * Returns:    A pointer to the object or NULL in case of failure (kmalloc
+ *             failed). */
+void* ObjectCache_allocate(ObjectCache* cache)
+{
+	if (!cache)
+		return NULL;
+
+	uint32_t eflags = kInterruptsDisable();
+	void* object = cache->free;
+
+	if (!object)
+	{
+		/* Build the slab with interrupts as the caller had them. Others may
+		 * grow the cache meanwhile, which only adds objects. */
+		kInterruptsRestore(eflags);
+
+		void* last;
+		ObjectCache_slab* s = ObjectCache_buildSlab(cache, &last);
+
+		eflags = kInterruptsDisable();
+
+		if (s)
+			ObjectCache_addSlab(cache, s, last);
+
+		object = cache->free;
+	}
+
+	if (object)
+	{
+		cache->free = *(void**) ((uint8_t*) object + cache->linkOffset);
+
+		cache->allocations++;
+		cache->inUse++;
+	}
+	else
+		cache->failures++;
+
+	kInterruptsRestore(eflags);
+
+	return object;
+}
+
+/* Function:   ObjectCache_free
+ * Purpose:    to return an object to its cache.
+ * Atomicity:  Disables interrupts for the free list operation
+ * Parameters: cache  [IN]: The cache the object was allocated from
+ *             object [IN]: The object */
+void ObjectCache_free(ObjectCache* cache, void* object)
+{
+	if (!cache || !object)
+	{
+		printf("ObjectCache: Trying to free a NULL pointer.\n");
+		kHUP();
+	}
+
+	uint32_t eflags = kInterruptsDisable();
+
+	*(void**) ((uint8_t*) object + cache->linkOffset) = cache->free;
+	cache->free = object;
+
+	cache->frees++;
+	cache->inUse--;
+
+	kInterruptsRestore(eflags);
+}
+
+/* Function:   ObjectCache_reserve
+ * Purpose:    to add slabs until a cache has a number of free objects, so
+ *             that interrupt handlers can allocate without going to the heap.
+ * Parameters: cache [IN]: The cache
+ *             count [IN]: Number of free objects to have
+ * Returns:    0 in case of success, -1 otherwise (kmalloc failed). */
+int ObjectCache_reserve(ObjectCache* cache, uint32_t count)
+{
+	if (!cache)
+		return -1;
+
+	for (;;)
+	{
+		uint32_t eflags = kInterruptsDisable();
+		uint32_t available =
+			cache->slabCount * cache->objectsPerSlab - cache->inUse;
+
+		kInterruptsRestore(eflags);
+
+		if (available >= count)
+			return 0;
+
+		void* last;
+		ObjectCache_slab* s = ObjectCache_buildSlab(cache, &last);
+
+		if (!s)
+			return -1;
+
+		eflags = kInterruptsDisable();
+		ObjectCache_addSlab(cache, s, last);
+		kInterruptsRestore(eflags);
+	}
+}
+
+/* Function:   ObjectCache_print
+ * Purpose:    to print a cache's statistics, useful for debugging.
+ * Parameters: cache [IN]: The cache */
+void ObjectCache_print(ObjectCache* cache)
+{
+	if (cache)
+	{
+		printf("ObjectCache %s: size %d, stride %d, %d slabs of %d objects,\n"
+			"    %d in use, %d allocations, %d frees, %d failures\n",
+			cache->name,
+			(int) cache->objectSize,
+			(int) cache->stride,
+			(int) cache->slabCount,
+			(int) cache->objectsPerSlab,
+			(int) cache->inUse,
+			(int) cache->allocations,
+			(int) cache->frees,
+			(int) cache->failures);
+	}
+}
+
+/* Function:   ObjectCache_buildSlab
+ * Purpose:    to allocate a slab from the heap and construct and thread its
+ *             objects. The slab is not yet added to the cache.
+ * Atomicity:  Not atomic (internal helper), touches no cache state
+ * Parameters: cache [IN]:  The cache
+ *             last  [OUT]: The last object of the slab's free list
+ * Returns:    The slab or NULL in case of failure (kmalloc failed). */
+static ObjectCache_slab* ObjectCache_buildSlab(ObjectCache* cache,
+	void** last)
+{
+	/* The heap only guarantees its own alignment */
+	uint32_t padding = cache->alignment > MEMORY_MANAGEMENT_ALIGNMENT ?
+		cache->alignment - 1 : 0;
+
+	ObjectCache_slab* s = kmalloc(sizeof(ObjectCache_slab) + padding +
+		cache->objectsPerSlab * cache->stride);
+
+	if (!s)
+		return NULL;
+
+	uint8_t* first = (uint8_t*) (((uintptr_t) (s + 1) + cache->alignment - 1) &
+		~(uintptr_t) (cache->alignment - 1));
+	uint8_t* object = first;
+
+	s->first = first;
+
+	/* Thread the objects in address order */
+	for (uint32_t i = 0; i < cache->objectsPerSlab; i++)
+	{
+		if (cache->constructor)
+			cache->constructor(object);
+
+		*(void**) (object + cache->linkOffset) = object + cache->stride;
+
+		*last = object;
+		object += cache->stride;
+	}
+
+	return s;
+}
+
+/* Function:   ObjectCache_addSlab
+ * Purpose:    to put a built slab's objects on the cache's free list.
+ * Atomicity:  Called with interrupts disabled (internal helper)
+ * Parameters: cache [IN]: The cache
+ *             s     [IN]: The slab
+ *             last  [IN]: The last object of the slab's free list */
+static void ObjectCache_addSlab(ObjectCache* cache, ObjectCache_slab* s,
+	void* last)
+{
+	s->next = cache->slabs;
+	cache->slabs = s;
+	cache->slabCount++;
+
+	*(void**) ((uint8_t*) last + cache->linkOffset) = cache->free;
+	cache->free = s->first;
+}
@@ -1,6 +1,79 @@
 #include "stdio.h"
+#include "string.h"
+#include "ObjectCache.h"
 #include "ethernet.h"
 
+/* Caches for the packet structures and their data buffers. Packets are
+ * allocated in the receive interrupt handler, for every frame. */
+static ObjectCache* ethernet_packetCache = NULL;
+static ObjectCache* ethernet_dataCache = NULL;
+
+/* Function:   ethernet_initialize
+ * Purpose:    to create the caches packets are allocated from and fill them
+ *             for the receive interrupt handlers. Must be called before any
+ *             packet is allocated.
+ * Parameters: None.
+ * Returns:    0 in case of success, -1 otherwise (kmalloc failed). */
+int ethernet_initialize(void)
+{
+	ethernet_packetCache = ObjectCache_create("ethernet2_packet",
+		sizeof(ethernet2_packet), 0, NULL);
+	ethernet_dataCache = ObjectCache_create("ethernet2_data",
+		ETHERNET_MAX_DATA_SIZE, 0, NULL);
+
+	if (!ethernet_packetCache || !ethernet_dataCache ||
+		ObjectCache_reserve(ethernet_packetCache, ETHERNET_RESERVED_PACKETS) < 0 ||
+		ObjectCache_reserve(ethernet_dataCache, ETHERNET_RESERVED_PACKETS) < 0)
+	{
+		ObjectCache_destroy(ethernet_packetCache);
+		ObjectCache_destroy(ethernet_dataCache);
+		ethernet_packetCache = ethernet_dataCache = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Function:   ethernet_allocatePacket
+ * Purpose:    to allocate a zeroed packet structure with a data buffer.
+ * Parameters: dataSize [IN]: Size of the packet's data, at most
+ *                            ETHERNET_MAX_DATA_SIZE
+ * Returns:    A pointer to the packet or NULL in case of failure (dataSize
+ *             too big or out of memory). */
+ethernet2_packet* ethernet_allocatePacket(uint16_t dataSize)
+{
+	if (dataSize > ETHERNET_MAX_DATA_SIZE)
+		return NULL;
+
+	ethernet2_packet* pkt = ObjectCache_allocate(ethernet_packetCache);
+
+	if (pkt)
+	{
+		bzero(pkt, sizeof(*pkt));
+
+		pkt->dataSize = dataSize;
+		pkt->data = ObjectCache_allocate(ethernet_dataCache);
+
+		if (!pkt->data)
+		{
+			ObjectCache_free(ethernet_packetCache, pkt);
+			pkt = NULL;
+		}
+	}
+
+	return pkt;
+}
+
+/* Function:   ethernet_freePacket
+ * Purpose:    to free a packet allocated with ethernet_allocatePacket,
+ *             including its data buffer.
+ * Parameters: pkt [IN]: The packet. */
+void ethernet_freePacket(ethernet2_packet* pkt)
+{
+	ObjectCache_free(ethernet_dataCache, pkt->data);
+	ObjectCache_free(ethernet_packetCache, pkt);
+}
+
 /* Function:   ethernet_ntohs
  * Purpose:    to convert a 16 byte value from network to host byte ordering.
  * Parameters: netshort [IN]: The network like ordered 16 bit word.
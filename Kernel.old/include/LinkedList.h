@@ -23,6 +23,7 @@ struct _LinkedList
 };
 
 /* Prototypes, for documentation see source code (includes comments) */
+int LinkedList_initialize(void);
 LinkedList* LinkedList_create(void);
 void LinkedList_destroy(LinkedList* l);
 int LinkedList_append(LinkedList* l, const void* p);
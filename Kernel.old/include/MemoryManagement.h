@@ -1,35 +1,116 @@
 /* Memory management. Provides dynamically allocatable memory and defines the
- * kmalloc and kfree macros. */
+ * kmalloc and kfree macros.
+ *
+ * The heap is a two-level segregated fit (TLSF) allocator. Free blocks are
+ * kept in segregated lists: the first level splits sizes into powers of two,
+ * the second level splits each power of two range into
+ * MEMORY_MANAGEMENT_SL_COUNT lists. Two levels of bitmaps tell which lists
+ * are not empty, so a fitting free block is found with two bit scans.
+ * Boundary tags (the physically previous block is recorded in each header)
+ * allow merging freed blocks with both neighbours without walking any list.
+ * Allocating and freeing thus take constant time, independent of the number
+ * of blocks. kmalloc and kfree keep interrupts disabled for one such
+ * operation only; kfree with interrupts disabled just queues the block.
+ *
+ * If MEMORY_MANAGEMENT_PROFILE is defined, allocations are accounted to the
+ * call sites of kmalloc, and MemoryManagement_print reports the sites with
+ * the most live bytes and the longest time interrupts were disabled by
+ * kmalloc or kfree. Otherwise, none of the profiling code is compiled
+ * in. */
 #ifndef MEMORY_MANAGEMENT_H
 #define MEMORY_MANAGEMENT_H
 
 #include "stddef.h"
 #include "stdint.h"
 
-enum MemoryManagement_regionType
-{
-	MEMORY_MANAGEMENT_REGION_FREE,
-	MEMORY_MANAGEMENT_REGION_OCCUPIED
-};
+/* Blocks start at and their sizes are multiples of the alignment */
+#define MEMORY_MANAGEMENT_ALIGNMENT_LOG2 3
+#define MEMORY_MANAGEMENT_ALIGNMENT (1 << MEMORY_MANAGEMENT_ALIGNMENT_LOG2)
+
+/* Number of second level lists per power of two */
+#define MEMORY_MANAGEMENT_SL_LOG2 4
+#define MEMORY_MANAGEMENT_SL_COUNT (1 << MEMORY_MANAGEMENT_SL_LOG2)
+
+/* Sizes below MEMORY_MANAGEMENT_SMALL_SIZE share the first level list 0,
+ * which is split linearly. Larger sizes get a list per power of two up to
+ * 2^31. */
+#define MEMORY_MANAGEMENT_FL_SHIFT \
+	(MEMORY_MANAGEMENT_SL_LOG2 + MEMORY_MANAGEMENT_ALIGNMENT_LOG2)
+#define MEMORY_MANAGEMENT_SMALL_SIZE (1 << MEMORY_MANAGEMENT_FL_SHIFT)
+#define MEMORY_MANAGEMENT_FL_COUNT (32 - MEMORY_MANAGEMENT_FL_SHIFT + 1)
 
-typedef struct _MemoryManagement_regionHeader MemoryManagement_regionHeader;
-struct _MemoryManagement_regionHeader
+/* Largest size that can be allocated */
+#define MEMORY_MANAGEMENT_MAX_SIZE 0x80000000U
+
+#define MEMORY_MANAGEMENT_MAGIC 0x12345678
+
+/* Flags in the low bits of a block's size */
+#define MEMORY_MANAGEMENT_BLOCK_FREE 0x1
+#define MEMORY_MANAGEMENT_BLOCK_PREVIOUS_FREE 0x2
+#define MEMORY_MANAGEMENT_BLOCK_DEFERRED 0x4
+#define MEMORY_MANAGEMENT_BLOCK_FLAGS \
+	(MEMORY_MANAGEMENT_BLOCK_FREE | MEMORY_MANAGEMENT_BLOCK_PREVIOUS_FREE | \
+	 MEMORY_MANAGEMENT_BLOCK_DEFERRED)
+
+typedef struct _MemoryManagement_blockHeader MemoryManagement_blockHeader;
+struct _MemoryManagement_blockHeader
 {
-	MemoryManagement_regionHeader* previous;
-	MemoryManagement_regionHeader* next;
+	/* Boundary tag. Only valid if MEMORY_MANAGEMENT_BLOCK_PREVIOUS_FREE is
+	 * set. */
+	MemoryManagement_blockHeader* previousPhysical;
+
+	/* Size of the payload, combined with the MEMORY_MANAGEMENT_BLOCK_* flags */
 	uint32_t size;
 
-	/* Must always be 0x12345678 to ensure integrity */
+	/* Must always be MEMORY_MANAGEMENT_MAGIC to ensure integrity */
 	uint32_t magic;
 
-	enum MemoryManagement_regionType type;
+#ifdef MEMORY_MANAGEMENT_PROFILE
+	/* Index of the allocating call site, fits into the alignment padding */
+	uint32_t site;
+#endif
+
+	/* Links in the segregated free list. They are stored in the payload, so
+	 * they are only valid for free blocks. */
+	MemoryManagement_blockHeader* nextFree
+		__attribute__((aligned(MEMORY_MANAGEMENT_ALIGNMENT)));
+	MemoryManagement_blockHeader* previousFree;
+};
+
+/* Bytes in front of the payload, and the smallest payload that holds the free
+ * list links */
+#define MEMORY_MANAGEMENT_BLOCK_OVERHEAD \
+	offsetof(MemoryManagement_blockHeader, nextFree)
+#define MEMORY_MANAGEMENT_MIN_BLOCK_SIZE \
+	(sizeof(MemoryManagement_blockHeader) - MEMORY_MANAGEMENT_BLOCK_OVERHEAD)
+
+#ifdef MEMORY_MANAGEMENT_PROFILE
+/* Number of call sites recorded (a power of 2) and printed */
+#define MEMORY_MANAGEMENT_PROFILE_SITES 64
+#define MEMORY_MANAGEMENT_PROFILE_TOP 10
+
+typedef struct _MemoryManagement_profileSite MemoryManagement_profileSite;
+struct _MemoryManagement_profileSite
+{
+	/* Return address of the kmalloc call */
+	void* caller;
+
+	uint32_t allocations;
+	uint32_t frees;
+	uint32_t liveBytes;
+	uint32_t peakLiveBytes;
+
+	/* TSC of the site's first allocation */
+	uint64_t firstSeen;
 };
+#endif
 
 #define kmalloc MemoryManagement_allocate
 #define kfree MemoryManagement_free
 
-extern __attribute__((cdecl)) void* MemoryManagement_allocate(size_t size);
-extern __attribute__((cdecl)) void MemoryManagement_free(void* pmem);
+__attribute__((cdecl)) void* MemoryManagement_allocate(size_t size);
+__attribute__((cdecl)) void MemoryManagement_free(void* pmem);
+void MemoryManagement_drainDeferred(void);
 extern __attribute__((cdecl)) uint32_t MemoryManagement_getTotalMemory(void);
 extern __attribute__((cdecl)) uint32_t MemoryManagement_getFreeMemory(void);
 extern __attribute__((cdecl)) void MemoryManagement_addRegion(uint32_t base, uint32_t size);
@@ -0,0 +1,72 @@
+/* Object caches. Provide fixed size objects of one type, e.g. packet
+ * structures, without going through the general purpose heap.
+ *
+ * A cache takes slabs of several objects at once from the heap and keeps
+ * freed objects on its own free list, so allocating and freeing an object is
+ * a list operation. If a constructor is given, it is run once when a slab is
+ * added to the cache. Freed objects are expected to be returned in their
+ * constructed state, which is why the free list link is then stored behind
+ * the object instead of inside it. Slabs are returned to the heap when the
+ * cache is destroyed.
+ *
+ * The allocate and free operations are atomic in respect to interrupts and
+ * disable them for a list operation only. Interrupt handlers should allocate
+ * from caches filled in advance with ObjectCache_reserve, so they need not
+ * build slabs. */
+#ifndef OBJECT_CACHE_H
+#define OBJECT_CACHE_H
+
+#include "stddef.h"
+#include "stdint.h"
+#include "MemoryManagement.h"
+
+/* Size of a slab, unless that is less than OBJECT_CACHE_MIN_OBJECTS objects */
+#define OBJECT_CACHE_SLAB_SIZE 4096
+#define OBJECT_CACHE_MIN_OBJECTS 8
+
+typedef void (*ObjectCache_constructor)(void* object);
+
+typedef struct _ObjectCache_slab ObjectCache_slab;
+struct _ObjectCache_slab
+{
+	/* Keeps the first object at the heap's alignment */
+	ObjectCache_slab* next __attribute__((aligned(MEMORY_MANAGEMENT_ALIGNMENT)));
+	void* first;
+};
+
+typedef struct _ObjectCache ObjectCache;
+struct _ObjectCache
+{
+	const char* name;
+
+	/* Size and alignment of the objects as requested, the distance between
+	 * two objects in a slab and where the free list link is stored */
+	uint32_t objectSize;
+	uint32_t alignment;
+	uint32_t stride;
+	uint32_t linkOffset;
+
+	uint32_t objectsPerSlab;
+	ObjectCache_constructor constructor;
+
+	ObjectCache_slab* slabs;
+	void* free;
+
+	/* Statistics */
+	uint32_t slabCount;
+	uint32_t allocations;
+	uint32_t frees;
+	uint32_t failures;
+	uint32_t inUse;
+};
+
+/* Prototypes, for documentation see source code */
+ObjectCache* ObjectCache_create(const char* name, uint32_t objectSize,
+	uint32_t alignment, ObjectCache_constructor constructor);
+void ObjectCache_destroy(ObjectCache* cache);
+void* ObjectCache_allocate(ObjectCache* cache);
+void ObjectCache_free(ObjectCache* cache, void* object);
+int ObjectCache_reserve(ObjectCache* cache, uint32_t count);
+void ObjectCache_print(ObjectCache* cache);
+
+#endif /* OBJECT_CACHE_H */
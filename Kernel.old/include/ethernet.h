@@ -4,6 +4,15 @@
 #ifndef ETHERNET_H
 #define ETHERNET_H
 
+#include <stdint.h>
+
+/* Largest payload of an ethernet 2 frame. Packet data buffers have this
+ * size. */
+#define ETHERNET_MAX_DATA_SIZE 1500
+
+/* Packets kept ready for the receive interrupt handlers */
+#define ETHERNET_RESERVED_PACKETS 16
+
 typedef struct _ethernet2_packet ethernet2_packet;
 struct _ethernet2_packet
 {
@@ -15,6 +24,9 @@ struct _ethernet2_packet
 };
 
 /* Function prototypes */
+int ethernet_initialize(void);
+ethernet2_packet* ethernet_allocatePacket(uint16_t dataSize);
+void ethernet_freePacket(ethernet2_packet* pkt);
 uint16_t ethernet_ntohs(uint16_t netshort);
 uint16_t ethernet_htons(uint16_t hostshort);
 
@@ -35,6 +35,30 @@ static inline void kHLT(void)
 	asm volatile ( "hlt" : );
 }
 
+/* Interrupt flag in EFLAGS */
+#define EFLAGS_IF 0x200
+
+/* Disables interrupts and returns the previous EFLAGS for
+ * kInterruptsRestore */
+static inline uint32_t kInterruptsDisable(void)
+{
+	uint32_t eflags;
+	asm volatile ( "pushfl\n\tpopl %0\n\tcli" : "=r"(eflags) : : "memory" );
+	return eflags;
+}
+
+static inline void kInterruptsRestore(uint32_t eflags)
+{
+	asm volatile ( "pushl %0\n\tpopfl" : : "r"(eflags) : "memory", "cc" );
+}
+
+static inline uint64_t rdtsc(void)
+{
+	uint64_t ret;
+	asm volatile ( "rdtsc" : "=A"(ret) );
+	return ret;
+}
+
 // terminal
 void terminal_putchar (char c);
 void terminal_writestring (const char* data);
@@ -10,6 +10,7 @@
 #include "NE2000.h"
 #include "isabus.h"
 #include "isr_handlers.h"
+#include "LinkedList.h"
 #include "ethernet.h"
 #include "isoosi/layer3.h"
 
@@ -55,6 +56,12 @@ void kernel_main (void) {
 	/* Print available memory */
 	kernel_print_memory_info();
 
+	/* Create the object caches */
+	if (LinkedList_initialize() < 0 || ethernet_initialize() < 0)
+	{
+		printf("Creating object caches failed.\n");
+	}
+
 	/* PnP detect cards */
 	if (isapnp_detect_configure())
 	{
@@ -89,6 +96,9 @@ void kernel_main (void) {
 				printMac (pkt->macDestination);
 				printf ("\nData size: %d\n", (int) pkt->dataSize); */
 				layer3_in(pkt);
+
+				/* Free what the receive interrupt handler could not */
+				MemoryManagement_drainDeferred();
 			}
 
 			printf ("NE2000_next_pkt failed.\n");
@@ -17,8 +17,7 @@ int layer3_in(ethernet2_packet* pkt)
 	switch (pkt->type)
 	{
 		case 0x800:
-			kfree(pkt->data);
-			kfree(pkt);
+			ethernet_freePacket(pkt);
 			break;
 
 		case 0x806:
@@ -27,8 +26,7 @@ int layer3_in(ethernet2_packet* pkt)
 
 		default:
 			printf ("Unknown ethernet 2 frame type: 0x%x\n", (int) pkt->type);
-			kfree(pkt->data);
-			kfree(pkt);
+			ethernet_freePacket(pkt);
 			break;
 	}
 	return 0;
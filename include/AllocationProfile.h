@@ -0,0 +1,74 @@
+#ifndef ALLOCATION_PROFILE_H
+#define ALLOCATION_PROFILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/******************************** Usage ***************************************
+ *
+ * An Allocation Profile accounts allocations and frees to the call sites
+ * that made the allocations, to find out which code uses the most memory or
+ * allocates the most often. Allocators use it in a profiling mode that is
+ * enabled at compile time, e.g. MEMORY_ALLOCATOR_PROFILE.
+ *
+ * ## Initializing an Allocation Profile
+ *   1. Somehow allocate an AllocationProfile structure
+ *   2. Call AllocationProfile_init
+ *   3. Set clock to get allocation rates
+ *
+ * The allocator calls AllocationProfile_allocated with the caller's address,
+ * e.g. __builtin_return_address (0), and keeps the returned site index with
+ * the object until it is freed. Up to ALLOCATION_PROFILE_SITES call sites
+ * are recorded; allocations from further sites are accounted to one site
+ * with a caller of NULL.
+ *
+ * The profile does no locking.
+ *
+ *****************************************************************************/
+
+/* A power of 2 */
+#define ALLOCATION_PROFILE_SITES	64
+
+typedef struct _AllocationProfile_site AllocationProfile_site;
+struct _AllocationProfile_site
+{
+	/* Return address of the allocation call */
+	void *caller;
+
+	uint32_t allocations;
+	uint32_t frees;
+
+	uint64_t allocated_bytes;
+	uint64_t live_bytes;
+	uint64_t peak_live_bytes;
+
+	/* Clock value of the site's first allocation */
+	uint64_t first_seen;
+};
+
+typedef struct _AllocationProfile AllocationProfile;
+struct _AllocationProfile
+{
+	/* Returns a monotonic timestamp, e.g. the TSC. If NULL, no allocation
+	 * rates are reported. */
+	uint64_t (*clock) (void);
+
+	/* Sites are hashed by caller into the first ALLOCATION_PROFILE_SITES
+	 * entries, the last one collects the sites that do not fit */
+	AllocationProfile_site sites[ALLOCATION_PROFILE_SITES + 1];
+};
+
+/* Public API */
+void AllocationProfile_init (AllocationProfile *profile);
+
+/* Returns the index of the caller's site */
+uint32_t AllocationProfile_allocated (AllocationProfile *profile,
+		void *caller, size_t size);
+
+void AllocationProfile_freed (AllocationProfile *profile, uint32_t site,
+		size_t size);
+
+/* Prints the top sites by live bytes, then by allocations */
+void AllocationProfile_print (AllocationProfile *profile, unsigned int top);
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "PageFrameAllocator.h"
+
+/******************************** Usage ***************************************
+ *
+ * An arena hands out memory for objects that are freed together, e.g. while
+ * processing one packet or during a boot phase. Objects are never freed one
+ * by one, so allocating is a pointer increment and nothing is left behind in
+ * the heap.
+ *
+ * ## Initializing an Arena
+ *   1. Somehow allocate an Arena structure
+ *   2. Call Arena_init
+ *   3. Set map if frames are not identity mapped
+ *
+ * Memory comes in chunks of ARENA_CHUNK_FRAMES frames from the Page Frame
+ * Allocator, or bigger ones for bigger requests. Chunks start with an
+ * Arena_chunk header and are chained, the most recent one first.
+ *
+ * Arena_mark records the current position and Arena_rewind frees everything
+ * allocated since then. Marks must be rewound in reverse order. Arena_release
+ * frees everything and returns all chunks to the Page Frame Allocator.
+ * One chunk that becomes unused by a rewind is kept, so a mark/rewind cycle
+ * across a chunk boundary does not allocate and free frames every time.
+ *
+ * The arena does no locking.
+ *
+ *****************************************************************************/
+
+#define ARENA_CHUNK_FRAMES	4
+
+/* Alignment of Arena_alloc */
+#define ARENA_ALIGNMENT		8
+
+typedef struct _Arena_chunk Arena_chunk;
+struct _Arena_chunk
+{
+	/* The chunk allocated before */
+	Arena_chunk *previous;
+
+	/* Physical address and size of the frames */
+	uint64_t address;
+	uint32_t frame_count;
+
+	uint8_t *end;
+} __attribute__((aligned (ARENA_ALIGNMENT)));
+
+typedef struct _Arena Arena;
+struct _Arena
+{
+	PageFrameAllocator *pfa;
+
+	/* Returns a pointer to the frames at a physical address. If NULL, frames
+	 * are assumed to be identity mapped. */
+	void *(*map) (uint64_t address);
+
+	/* The chunk allocations are taken from, and the free space in it */
+	Arena_chunk *current;
+	uint8_t *top;
+
+	/* A default sized chunk kept for reuse */
+	Arena_chunk *spare;
+
+	/* Number of chunks in use and bytes allocated since Arena_init or
+	 * Arena_release */
+	uint32_t chunk_count;
+	uint64_t allocated;
+};
+
+/* A position in an arena */
+typedef struct _Arena_mark Arena_mark;
+struct _Arena_mark
+{
+	Arena_chunk *chunk;
+	uint8_t *top;
+	uint64_t allocated;
+};
+
+/* Public API */
+void Arena_init (Arena *arena, PageFrameAllocator *pfa);
+void *Arena_alloc (Arena *arena, size_t size);
+void *Arena_alloc_aligned (Arena *arena, size_t size, size_t alignment);
+
+Arena_mark Arena_get_mark (Arena *arena);
+void Arena_rewind (Arena *arena, Arena_mark mark);
+
+/* Frees all objects and returns all chunks to the Page Frame Allocator */
+void Arena_release (Arena *arena);
+
+#endif
@@ -5,35 +5,150 @@
 #include <stddef.h>
 #include "PageFrameAllocator.h"
 
+#ifdef MEMORY_ALLOCATOR_PROFILE
+#include "AllocationProfile.h"
+#endif
+
 /******************************** Usage ***************************************
  *
  * ## Initializing a Memory Allocator
  *   1. Somehow allocate a MemoryAllocator structure
  *   2. Call MemoryAllocator_init
+ *   3. Set map if frames are not identity mapped
+ *
+ * Requests of up to MEMORY_ALLOCATOR_MAX_SIZE bytes are rounded up to a power
+ * of 2 and served from slabs of that size class. A slab is a naturally
+ * aligned run of MEMORY_ALLOCATOR_SLAB_FRAMES frames, starting with a
+ * MemoryAllocator_slab header. Freed objects are kept on a free list per
+ * slab, so allocating and freeing take constant time. Objects are aligned to
+ * their size, up to 64 bytes.
+ *
+ * Bigger requests get a run of frames of their own, which starts with a
+ * header, too. Either way, MemoryAllocator_free finds the header by aligning
+ * the pointer down to the slab size. If the Page Frame Allocator keeps frame
+ * descriptors, each frame is tagged with its header, too.
+ *
+ * Slabs that become empty are returned to the Page Frame Allocator, except
+ * for one per size class to avoid allocating and freeing frames over and
+ * over again. MemoryAllocator_trim returns those, too.
+ *
+ * The allocator does no locking.
+ *
+ * ## Profiling
+ * If MEMORY_ALLOCATOR_PROFILE is defined, allocations are accounted to their
+ * call sites in an AllocationProfile (see there), whose clock may be set
+ * after MemoryAllocator_init. MemoryAllocator_print_profile prints the
+ * report. Each object is then preceded by a MemoryAllocator_profile_tag,
+ * which moves requests to bigger size classes and reduces the objects'
+ * alignment to 16 bytes. Without MEMORY_ALLOCATOR_PROFILE, none of this is
+ * compiled in.
+ *
  *****************************************************************************/
 
-typedef struct _MemoryAllocator_range MemoryAllocator_range;
-struct _MemoryAllocator_range
+#define MEMORY_ALLOCATOR_SLAB_FRAMES	4
+#define MEMORY_ALLOCATOR_SLAB_SIZE		(MEMORY_ALLOCATOR_SLAB_FRAMES * 4096)
+
+/* Size classes are 2^MEMORY_ALLOCATOR_MIN_SHIFT to 2^MEMORY_ALLOCATOR_MAX_SHIFT
+ * bytes */
+#define MEMORY_ALLOCATOR_MIN_SHIFT		4
+#define MEMORY_ALLOCATOR_MAX_SHIFT		11
+#define MEMORY_ALLOCATOR_MAX_SIZE		(1U << MEMORY_ALLOCATOR_MAX_SHIFT)
+#define MEMORY_ALLOCATOR_CLASS_COUNT \
+	(MEMORY_ALLOCATOR_MAX_SHIFT - MEMORY_ALLOCATOR_MIN_SHIFT + 1)
+
+/* Space reserved for the header at the beginning of each slab or big run */
+#define MEMORY_ALLOCATOR_HEADER_SIZE	64
+
+#define MEMORY_ALLOCATOR_MAGIC			0x51ab51ab
+
+typedef struct _MemoryAllocator_object MemoryAllocator_object;
+struct _MemoryAllocator_object
+{
+	MemoryAllocator_object *next;
+};
+
+typedef struct _MemoryAllocator_slab MemoryAllocator_slab;
+struct _MemoryAllocator_slab
+{
+	uint32_t magic;
+
+	/* Size of the objects, 0 for the run of a big request */
+	uint32_t object_size;
+
+	/* Physical address and size of the frames */
+	uint64_t address;
+	uint32_t frame_count;
+
+	/* Number of allocated objects */
+	uint32_t used;
+
+	/* Links in the size class' list of slabs with free objects */
+	MemoryAllocator_slab *next;
+	MemoryAllocator_slab *previous;
+
+	/* Freed objects, and the objects that were never handed out, which start
+	 * at unused */
+	MemoryAllocator_object *free;
+	uint8_t *unused;
+	uint8_t *end;
+};
+
+typedef struct _MemoryAllocator_class MemoryAllocator_class;
+struct _MemoryAllocator_class
 {
-	MemoryAllocator_range *next;
-	MemoryAllocator_range *previous;
+	/* Slabs with at least one free object */
+	MemoryAllocator_slab *partial;
+
+	/* Number of slabs in partial without any allocated object */
+	uint32_t empty_slabs;
+};
 
-	uint8_t *begin;
+#ifdef MEMORY_ALLOCATOR_PROFILE
+/* Space reserved in front of each object in profiling mode */
+#define MEMORY_ALLOCATOR_PROFILE_TAG_SIZE	16
+
+typedef struct _MemoryAllocator_profile_tag MemoryAllocator_profile_tag;
+struct _MemoryAllocator_profile_tag
+{
+	uint32_t site;
 	uint32_t size;
-} __attribute__((packed));
+};
+#endif
 
 typedef struct _MemoryAllocator MemoryAllocator;
 struct _MemoryAllocator
 {
 	PageFrameAllocator *pfa;
 
-	MemoryAllocator_range *allocated_ranges;
-	MemoryAllocator_range *free_ranges;
-} __attribute__((packed));
+	/* Returns a pointer to the frames at a physical address. If NULL, frames
+	 * are assumed to be identity mapped. */
+	void *(*map) (uint64_t address);
+
+	MemoryAllocator_class classes[MEMORY_ALLOCATOR_CLASS_COUNT];
+
+#ifdef MEMORY_ALLOCATOR_PROFILE
+	AllocationProfile profile;
+#endif
+};
 
 /* Public API */
 void MemoryAllocator_init (MemoryAllocator *ma, PageFrameAllocator *pfa);
 void *MemoryAllocator_alloc (MemoryAllocator *ma, size_t size);
 void MemoryAllocator_free (MemoryAllocator *ma, void *ptr);
 
+/* Returns the empty slabs kept for reuse to the Page Frame Allocator */
+void MemoryAllocator_trim (MemoryAllocator *ma);
+
+/* Prints the top call sites by live bytes if profiling is enabled */
+#ifdef MEMORY_ALLOCATOR_PROFILE
+void MemoryAllocator_print_profile (MemoryAllocator *ma, unsigned int top);
+#else
+static inline void MemoryAllocator_print_profile (
+		MemoryAllocator *ma, unsigned int top)
+{
+	(void) ma;
+	(void) top;
+}
+#endif
+
 #endif
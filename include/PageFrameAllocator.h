@@ -1,6 +1,7 @@
 #ifndef PAGE_FRAME_ALLOCATOR_H
 #define PAGE_FRAME_ALLOCATOR_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include "SystemMemoryMap.h"
 
@@ -8,24 +9,194 @@
  *
  * ## Initializing a Page Frame Allocator
  *   1. Somehow allocate a PageFrameAllocator structure.
- *   2. Fill mmap with a system's memory map
- *   3. Set frame_count to the number of frames available on the system
+ *   2. Point mmap to a system's normalized memory map
+ *   3. Set frame_count to the number of frames available on the system. It
+ *      must be less than PAGE_FRAME_ALLOCATOR_NO_FRAME.
  *   4. Fill bitmap_size and bitmap with a bitmap that is big enough
- *      to monitor the entire physical memory range
- *   5. Fill frame_size with the desired page frame size
- *   6. Call PageFrameAllocator_init_bitmap to initialize the bitmap from the
+ *      to monitor the entire physical memory range. The bitmap is searched
+ *      in 32 bit words, hence it must be 4 byte aligned and bitmap_size
+ *      must be a multiple of 4.
+ *   5. Fill summary_size and summary with a summary bitmap that has (at
+ *      least) one bit per 32 bit word of the bitmap. summary_size is in
+ *      bytes and must be a multiple of 4, too.
+ *   6. Fill frame_size with the desired page frame size
+ *   7. Set backend to PAGE_FRAME_ALLOCATOR_BITMAP or
+ *      PAGE_FRAME_ALLOCATOR_BUDDY. The buddy backend requires buddy_nodes to
+ *      point to an array of frame_count nodes.
+ *   8. Set huge_frames to the number of frames per large page (1024 for
+ *      4 MiB pages, 512 for 2 MiB pages with PAE). The bitmap backend
+ *      keeps free runs of that size intact if huge_free points to an array
+ *      of (frame_count + huge_frames - 1) / huge_frames counters, set it to
+ *      NULL otherwise.
+ *   9. Set zero_frame to a function that zeroes frames or NULL
+ *      (requires identity mapped memory)
+ *  10. Set pages to an array of frame_count descriptors or NULL
+ *  11. Call PageFrameAllocator_init_bitmap to initialize the bitmap from the
  *      memory map
- *   7. Use PageFrameAllocator_mark_used and PageFrameAllocator_mark_free to
+ *  12. Use PageFrameAllocator_mark_used and PageFrameAllocator_mark_free to
  *      adapt the usage information the way you like
  *
  *   Then you're done.
  *
+ * ## Frame descriptors
+ * If pages is set, each frame has a PageFrameAllocator_page. The allocate
+ * functions set the descriptors of the frames they hand out to one
+ * reference and no owner, the free functions reset them. Owners may tag
+ * their frames with PageFrameAllocator_set_owner, e.g. with the slab a frame
+ * belongs to, which PageFrameAllocator_page_of finds without searching.
+ * Frames that are shared are freed with PageFrameAllocator_put_page once
+ * the last reference is dropped. Frames marked used rather than allocated
+ * keep a reference count of 0.
+ *
+ * Addresses are 64 bit physical addresses. Frames above 4 GiB belong to the
+ * high zone, to map them on i386 PAE paging is required.
+ *
  *****************************************************************************/
 
+/* The biggest buddy block has 2^PAGE_FRAME_ALLOCATOR_BUDDY_MAX_ORDER frames,
+ * that is 4 MiB with 4 KiB frames. */
+#define PAGE_FRAME_ALLOCATOR_BUDDY_MAX_ORDER	10
+#define PAGE_FRAME_ALLOCATOR_BUDDY_NOT_FREE		0xff
+
+enum PageFrameAllocator_backend
+{
+	PAGE_FRAME_ALLOCATOR_BITMAP,
+	PAGE_FRAME_ALLOCATOR_BUDDY
+};
+
+typedef struct _PageFrameAllocator_buddy_node PageFrameAllocator_buddy_node;
+struct _PageFrameAllocator_buddy_node
+{
+	/* Free list links (frame numbers), only valid if order is not
+	 * PAGE_FRAME_ALLOCATOR_BUDDY_NOT_FREE */
+	uint32_t next;
+	uint32_t previous;
+
+	/* Order of the free block starting at this frame or
+	 * PAGE_FRAME_ALLOCATOR_BUDDY_NOT_FREE if no free block starts here */
+	uint8_t order;
+} __attribute__((packed));
+
+/* Owners of allocated frames, recorded in their descriptors */
+enum PageFrameAllocator_owner
+{
+	PAGE_FRAME_ALLOCATOR_OWNER_NONE,
+	PAGE_FRAME_ALLOCATOR_OWNER_PAGING,
+	PAGE_FRAME_ALLOCATOR_OWNER_MEMORY_ALLOCATOR,
+	PAGE_FRAME_ALLOCATOR_OWNER_ARENA,
+	PAGE_FRAME_ALLOCATOR_OWNER_VIRTUAL_MEMORY
+};
+
+/* Descriptor flags: the frame was handed out by an allocate function. The
+ * upper four bits are left to the owner. */
+#define PAGE_FRAME_ALLOCATOR_PAGE_ALLOCATED		0x01
+#define PAGE_FRAME_ALLOCATOR_PAGE_OWNER_FLAGS	0xf0
+
+/* Per-frame descriptor, 8 bytes on i386 so that a cache line holds eight */
+typedef struct _PageFrameAllocator_page PageFrameAllocator_page;
+struct _PageFrameAllocator_page
+{
+	/* Owner's data, e.g. the header of the slab the frame belongs to */
+	void *private;
+
+	uint16_t refcount;
+	uint8_t flags;
+
+	/* enum PageFrameAllocator_zone_index and enum PageFrameAllocator_owner */
+	uint8_t zone : 2;
+	uint8_t owner : 6;
+};
+
+/* Zones. ISA devices can only DMA below 16 MiB, high memory starts at
+ * 896 MiB and extends to the end of memory, including memory above 4 GiB.
+ * Both boundaries are aligned to the biggest buddy block. */
+#define PAGE_FRAME_ALLOCATOR_DMA_LIMIT			0x01000000ULL
+#define PAGE_FRAME_ALLOCATOR_HIGH_START			0x38000000ULL
+
+/* Physical addresses from here on cannot be reached without PAE */
+#define PAGE_FRAME_ALLOCATOR_PAE_START			0x100000000ULL
+
+enum PageFrameAllocator_zone_index
+{
+	PAGE_FRAME_ALLOCATOR_ZONE_DMA,
+	PAGE_FRAME_ALLOCATOR_ZONE_NORMAL,
+	PAGE_FRAME_ALLOCATOR_ZONE_HIGH,
+	PAGE_FRAME_ALLOCATOR_ZONE_COUNT
+};
+
+/* Allocation flags. Without a zone flag, frames come from the normal zone
+ * and, if that is exhausted, from the DMA zone. With
+ * PAGE_FRAME_ALLOCATOR_HIGH, the high zone is tried first. With
+ * PAGE_FRAME_ALLOCATOR_DMA, only the DMA zone is used. */
+#define PAGE_FRAME_ALLOCATOR_DMA				0x00000001
+#define PAGE_FRAME_ALLOCATOR_HIGH				0x00000002
+
+/* Allocation flag: the frames must be zeroed. Single frames are taken from
+ * the pool of pre-zeroed frames if possible, otherwise they are zeroed on
+ * allocation. Zeroing accesses the frames through the identity mapping, which
+ * does not cover the high zone, hence PAGE_FRAME_ALLOCATOR_HIGH is ignored
+ * and the frames come from the normal or DMA zone. */
+#define PAGE_FRAME_ALLOCATOR_ZERO				0x00000004
+
+/* Capacity of the pool of pre-zeroed frames */
+#define PAGE_FRAME_ALLOCATOR_ZERO_POOL_SIZE		64
+
+#define PAGE_FRAME_ALLOCATOR_PREFERRED_ZONE(FLAGS) \
+	((FLAGS) & PAGE_FRAME_ALLOCATOR_DMA ? PAGE_FRAME_ALLOCATOR_ZONE_DMA : \
+	 ((FLAGS) & (PAGE_FRAME_ALLOCATOR_HIGH | PAGE_FRAME_ALLOCATOR_ZERO)) == \
+	 PAGE_FRAME_ALLOCATOR_HIGH ? PAGE_FRAME_ALLOCATOR_ZONE_HIGH : \
+	 PAGE_FRAME_ALLOCATOR_ZONE_NORMAL)
+
+/* Number of buckets in the free run length histogram */
+#define PAGE_FRAME_ALLOCATOR_HISTOGRAM_BUCKETS	12
+
+typedef struct _PageFrameAllocator_zone PageFrameAllocator_zone;
+struct _PageFrameAllocator_zone
+{
+	/* The zone spans the frames first_frame to end_frame - 1 */
+	uint32_t first_frame;
+	uint32_t end_frame;
+
+	uint32_t free_frame_count;
+
+	/* Frame at which the next free frame search in this zone starts. It
+	 * rotates through the zone, so that allocations do not rescan the used
+	 * frames at the zone's beginning over and over again. */
+	uint32_t next_free_hint;
+
+	/* Buddy backend only: heads of the free lists per order
+	 * (PAGE_FRAME_ALLOCATOR_NO_FRAME if empty). */
+	uint32_t buddy_free[PAGE_FRAME_ALLOCATOR_BUDDY_MAX_ORDER + 1];
+};
+
+/* Reset by PageFrameAllocator_init_bitmap. Only the allocate and free
+ * functions are accounted, not mark_used, mark_free and their range
+ * variants. */
+typedef struct _PageFrameAllocator_stats PageFrameAllocator_stats;
+struct _PageFrameAllocator_stats
+{
+	/* Allocation requests and the ones that could not be satisfied */
+	uint32_t allocations;
+	uint32_t failures;
+
+	/* Frames handed out and returned */
+	uint32_t allocated_frames;
+	uint32_t freed_frames;
+
+	/* Single frame requests served from the pool of pre-zeroed frames */
+	uint32_t zero_pool_hits;
+
+	/* Loop iterations of free frame searches in the bitmap. The total
+	 * includes searches done by mark_range_free, the maximum is per
+	 * allocation request. */
+	uint32_t scanned_words;
+	uint32_t max_scanned_words;
+};
+
 typedef struct _PageFrameAllocator PageFrameAllocator;
 struct _PageFrameAllocator
 {
-	SystemMemoryMap mmap;
+	SystemMemoryMap *mmap;
 
 	uint32_t frame_size;
 
@@ -33,10 +204,57 @@ struct _PageFrameAllocator
 	unsigned int bitmap_size;
 	uint8_t *bitmap;
 
+	/* Second level of the bitmap. Bit n is set if all 32 frames tracked by
+	 * the n-th 32 bit word of the bitmap are used. The size is in bytes. */
+	unsigned int summary_size;
+	uint32_t *summary;
+
 	/* Number of frames available on the system */
 	uint32_t frame_count;
+
+	/* Number of free frames, maintained by mark_used and mark_free */
+	uint32_t free_frame_count;
+
+	/* Set up by PageFrameAllocator_init_bitmap */
+	PageFrameAllocator_zone zones[PAGE_FRAME_ALLOCATOR_ZONE_COUNT];
+
+	/* The allocation strategy. The bitmap is maintained by both backends, the
+	 * buddy backend keeps per-order free lists of aligned blocks in addition
+	 * to it. */
+	enum PageFrameAllocator_backend backend;
+
+	/* Buddy backend only: one node per frame */
+	PageFrameAllocator_buddy_node *buddy_nodes;
+
+	/* Frames per large page, a power of 2 and a multiple of 32 */
+	uint32_t huge_frames;
+
+	/* Bitmap backend only, optional: the number of free frames in each
+	 * naturally aligned run of huge_frames frames. Single frames are taken
+	 * from partially used runs first. The buddy backend achieves the same by
+	 * splitting the smallest free block. */
+	uint16_t *huge_free;
+
+	/* Zeroes size bytes of physical memory at address, e.g. with non-temporal
+	 * stores. It is only called for frames of the normal and DMA zones. If
+	 * NULL, bzero is used, which requires them to be identity mapped. */
+	void (*zero_frame) (uint64_t address, size_t size);
+
+	/* Optional: one descriptor per frame */
+	PageFrameAllocator_page *pages;
+
+	/* Addresses of allocated frames that are zeroed already. They count as
+	 * used. Set up by PageFrameAllocator_init_bitmap, filled by
+	 * PageFrameAllocator_refill_zero_pool. */
+	uint32_t zero_pool_count;
+	uint64_t zero_pool[PAGE_FRAME_ALLOCATOR_ZERO_POOL_SIZE];
+
+	PageFrameAllocator_stats stats;
 };
 
+/* Returned by internal searches if no suitable frame was found */
+#define PAGE_FRAME_ALLOCATOR_NO_FRAME	0xffffffff
+
 /* Functions' and procedures' prototypes */
 void PageFrameAllocator_init_bitmap (PageFrameAllocator *pfa);
 
@@ -53,6 +271,86 @@ void PageFrameAllocator_mark_range_free
 int PageFrameAllocator_check_frames_available (
 		PageFrameAllocator *pfa, unsigned int count);
 
-uint32_t PageFrameAllocator_allocate (PageFrameAllocator *pfa);
+uint64_t PageFrameAllocator_allocate (PageFrameAllocator *pfa);
+uint64_t PageFrameAllocator_allocate_flags (PageFrameAllocator *pfa, uint32_t flags);
+
+/* Allocates up to count single frames and stores their addresses in
+ * addresses. Free frames that share a bitmap word are taken with a single
+ * search. Returns the number of frames allocated. */
+uint32_t PageFrameAllocator_allocate_batch (
+		PageFrameAllocator *pfa, uint64_t *addresses, uint32_t count,
+		uint32_t flags);
+
+/* Allocates count physically contiguous frames. The first frame's number is a
+ * multiple of alignment, which is given in frames and must be a power of 2
+ * (0 and 1 mean no alignment). Returns the address of the first frame or 0 if
+ * no such run is free. */
+uint64_t PageFrameAllocator_allocate_range (
+		PageFrameAllocator *pfa, uint32_t count, uint32_t alignment);
+
+uint64_t PageFrameAllocator_allocate_range_flags (
+		PageFrameAllocator *pfa, uint32_t count, uint32_t alignment,
+		uint32_t flags);
+
+void PageFrameAllocator_free_range (
+		PageFrameAllocator *pfa, uint64_t address, uint32_t count);
+
+/* Allocates a naturally aligned run of huge_frames frames, which can be
+ * mapped with a large page. Returns its address or 0. */
+uint64_t PageFrameAllocator_allocate_huge (
+		PageFrameAllocator *pfa, uint32_t flags);
+
+/* Frees count single frames. Runs of consecutive addresses are freed as one
+ * range. */
+void PageFrameAllocator_free_batch (
+		PageFrameAllocator *pfa, const uint64_t *addresses, uint32_t count);
+
+/* Records the owner of count allocated frames starting at address and the
+ * owner's data in their descriptors. Does nothing without pages. */
+void PageFrameAllocator_set_owner (
+		PageFrameAllocator *pfa, uint64_t address, uint32_t count,
+		enum PageFrameAllocator_owner owner, void *private);
+
+/* Takes another reference to an allocated frame. Requires pages, without
+ * them or for frames that aren't allocated it prints a message and does
+ * nothing. */
+void PageFrameAllocator_get_page (PageFrameAllocator *pfa, uint64_t address);
+
+/* Drops a reference to an allocated frame and frees it if that was the last
+ * one. Requires pages, like PageFrameAllocator_get_page. Returns the number
+ * of references left. */
+uint32_t PageFrameAllocator_put_page (PageFrameAllocator *pfa, uint64_t address);
+
+/* Returns the descriptor of the frame at address or NULL if there are no
+ * descriptors or no such frame */
+static inline PageFrameAllocator_page *PageFrameAllocator_page_of (
+		PageFrameAllocator *pfa, uint64_t address)
+{
+	uint64_t frame = address / pfa->frame_size;
+
+	if (!pfa->pages || frame >= pfa->frame_count)
+		return NULL;
+
+	return &pfa->pages[frame];
+}
+
+/* Zeroes up to max_frames free frames and moves them to the pool of
+ * pre-zeroed frames. Meant to be called when the CPU is idle. Returns the
+ * number of frames added. */
+uint32_t PageFrameAllocator_refill_zero_pool (
+		PageFrameAllocator *pfa, uint32_t max_frames);
+
+/* Counts the runs of free frames by length. Bucket n counts runs of 2^n to
+ * 2^(n+1) - 1 frames, the last bucket all longer runs as well. Returns the
+ * length of the longest run. */
+uint32_t PageFrameAllocator_free_run_histogram (
+		PageFrameAllocator *pfa,
+		uint32_t histogram[PAGE_FRAME_ALLOCATOR_HISTOGRAM_BUCKETS]);
+
+/* Prints the statistics and the free run histogram. If machine_readable is
+ * set, a single line of key=value pairs starting with PFA_STATS is printed
+ * in addition, for scripts that parse the output. */
+void PageFrameAllocator_dump_stats (
+		PageFrameAllocator *pfa, int machine_readable);
 
 #endif /* PAGE_FRAME_ALLOCATOR_H */
@@ -0,0 +1,70 @@
+#ifndef PAGE_FRAME_CACHE_H
+#define PAGE_FRAME_CACHE_H
+
+#include <stdint.h>
+#include "PageFrameAllocator.h"
+
+/******************************** Usage ***************************************
+ *
+ * A Page Frame Cache keeps a small stack of free frames per CPU in front of a
+ * Page Frame Allocator. Single frame allocations and frees only touch the
+ * calling CPU's stack. The shared allocator is only locked and accessed to
+ * refill an empty stack or to drain a full one, PAGE_FRAME_CACHE_BATCH frames
+ * at a time. Frames held by a cache count as used in the allocator. Their
+ * descriptors, if the allocator has any, have no owner, a reference count of
+ * 0 and are not marked allocated until they are allocated from the cache
+ * again.
+ *
+ * ## Initializing a Page Frame Cache
+ *   1. Somehow allocate a PageFrameCache structure and an array of
+ *      PageFrameCache_cpu structures, one per CPU.
+ *   2. Call PageFrameCache_init
+ *
+ * The cpu argument of the functions below is the index of the calling CPU.
+ * Each CPU's stack must only be used by that CPU, and not from interrupt
+ * handlers that may interrupt a cache operation on the same CPU.
+ *
+ * While a cache is in use on more than one CPU, other users of the underlying
+ * Page Frame Allocator must hold the cache's lock (PageFrameCache_lock).
+ *
+ *****************************************************************************/
+
+/* Capacity of each CPU's stack and number of frames moved per refill/drain */
+#define PAGE_FRAME_CACHE_SIZE	64
+#define PAGE_FRAME_CACHE_BATCH	32
+
+typedef struct _PageFrameCache_cpu PageFrameCache_cpu;
+struct _PageFrameCache_cpu
+{
+	uint32_t count;
+
+	/* Addresses of free frames, the most recently freed one on top */
+	uint64_t frames[PAGE_FRAME_CACHE_SIZE];
+};
+
+typedef struct _PageFrameCache PageFrameCache;
+struct _PageFrameCache
+{
+	PageFrameAllocator *pfa;
+
+	/* Protects pfa */
+	volatile uint32_t lock;
+
+	unsigned int cpu_count;
+	PageFrameCache_cpu *cpus;
+};
+
+/* Public API */
+void PageFrameCache_init (PageFrameCache *cache, PageFrameAllocator *pfa,
+		PageFrameCache_cpu *cpus, unsigned int cpu_count);
+
+uint64_t PageFrameCache_allocate (PageFrameCache *cache, unsigned int cpu);
+void PageFrameCache_free (PageFrameCache *cache, unsigned int cpu, uint64_t address);
+
+/* Returns all frames of a CPU's stack to the allocator */
+void PageFrameCache_drain (PageFrameCache *cache, unsigned int cpu);
+
+void PageFrameCache_lock (PageFrameCache *cache);
+void PageFrameCache_unlock (PageFrameCache *cache);
+
+#endif /* PAGE_FRAME_CACHE_H */
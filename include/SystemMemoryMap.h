@@ -6,19 +6,62 @@
 /* Contains constants */
 #include "SystemMemoryMap.inc.h"
 
+/******************************** Usage ***************************************
+ *
+ * The real mode code of stage 2 collects up to SYSTEM_MEMORY_MAP_MAX_ENTRIES
+ * raw entries (e820 and well-known PC ranges) in the order they are
+ * reported. They may overlap and are not sorted.
+ *
+ * SystemMemoryMap_normalize turns them into a SystemMemoryMap: an array of
+ * entries sorted by start, without overlaps, in which adjacent entries of the
+ * same type are merged. Where raw entries overlap, the type with the lower
+ * number wins, free memory loses against everything else. Entries of unknown
+ * type count as reserved. Normalizing sorts the starts and ends of all
+ * entries and resolves overlaps in a single pass over them, which takes
+ * O(n log n) for n raw entries.
+ *
+ * Consumers iterate over entries[0] to entries[count - 1].
+ *
+ *****************************************************************************/
+
 typedef struct _SystemMemoryMap_entry SystemMemoryMap_entry;
 struct _SystemMemoryMap_entry
 {
-	SystemMemoryMap_entry *previous;
-	SystemMemoryMap_entry *next;
 	uint32_t type;
 	uint64_t start;
 	uint64_t size;
 } __attribute__((packed));
 
-typedef SystemMemoryMap_entry *SystemMemoryMap;
+typedef struct _SystemMemoryMap SystemMemoryMap;
+struct _SystemMemoryMap
+{
+	uint32_t count;
+	SystemMemoryMap_entry *entries;
+};
+
+/* The start or end of a raw entry, used while normalizing */
+typedef struct _SystemMemoryMap_boundary SystemMemoryMap_boundary;
+struct _SystemMemoryMap_boundary
+{
+	uint64_t address;
+
+	/* Index into the types ordered by precedence */
+	uint32_t precedence;
+
+	/* 1 for a start, -1 for an end */
+	int32_t delta;
+};
 
 /* Functions' and procedures' prototypes */
-uint64_t SystemMemoryMap_get_memory_size (SystemMemoryMap mmap);
+
+/* Normalizes raw_count raw entries into mmap. mmap->entries and boundaries
+ * must hold 2 * raw_count elements each. Returns the number of entries. */
+uint32_t SystemMemoryMap_normalize (SystemMemoryMap *mmap,
+		const SystemMemoryMap_entry *raw, uint32_t raw_count,
+		SystemMemoryMap_boundary *boundaries);
+
+uint64_t SystemMemoryMap_get_memory_size (const SystemMemoryMap *mmap);
+
+void SystemMemoryMap_dump (const SystemMemoryMap *mmap);
 
 #endif
@@ -0,0 +1,96 @@
+#ifndef VIRTUAL_MEMORY_H
+#define VIRTUAL_MEMORY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "PageFrameAllocator.h"
+#include "MemoryAllocator.h"
+#include "paging.h"
+
+/******************************** Usage ***************************************
+ *
+ * Virtual Memory hands out virtually contiguous buffers that are backed by
+ * single frames, which need not be contiguous. Big buffers thus do not
+ * depend on finding a physically contiguous run of free frames. It manages a
+ * window of the kernel's virtual address space that nothing else maps.
+ *
+ * ## Initializing Virtual Memory
+ *   1. Somehow allocate a VirtualMemory structure
+ *   2. Call VirtualMemory_init with the window's start and size, the paging
+ *      structures and a Memory Allocator for the bookkeeping
+ *
+ * The window is split into areas. Free areas are kept in an AVL tree ordered
+ * by address, in which each node records the biggest free area in its
+ * subtree. The lowest free area that fits a request is thus found in
+ * O(log n) without visiting areas that are too small. Areas in use are kept
+ * in a second AVL tree, so VirtualMemory_free finds an area's size by its
+ * address. Freed areas are merged with their free neighbours.
+ *
+ * VirtualMemory_reserve and VirtualMemory_unreserve manage address ranges
+ * only. VirtualMemory_alloc reserves a range, maps a frame to each of its
+ * pages and returns a pointer to it; VirtualMemory_free unmaps the frames
+ * and frees them. Each area is followed by an unmapped guard page, which
+ * catches overruns. The frames come from high memory below 4 GiB as long as
+ * there is some, normal memory is only used after that.
+ *
+ * Virtual Memory does no locking.
+ *
+ *****************************************************************************/
+
+/* Frames allocated or freed by one call to the Page Frame Allocator */
+#define VIRTUAL_MEMORY_BATCH	32
+
+typedef struct _VirtualMemory_area VirtualMemory_area;
+struct _VirtualMemory_area
+{
+	uint32_t start;
+	uint32_t size;
+
+	/* Biggest size in the subtree, maintained in the tree of free areas */
+	uint32_t max_size;
+
+	int32_t height;
+	VirtualMemory_area *left;
+	VirtualMemory_area *right;
+};
+
+typedef struct _VirtualMemory VirtualMemory;
+struct _VirtualMemory
+{
+	Paging *paging;
+	MemoryAllocator *ma;
+
+	/* The window of virtual addresses */
+	uint32_t start;
+	uint32_t size;
+
+	/* Roots of the trees of free areas and areas in use */
+	VirtualMemory_area *free;
+	VirtualMemory_area *used;
+
+	/* Statistics */
+	uint32_t used_count;
+	uint32_t mapped_pages;
+};
+
+/* Public API */
+
+/* Returns 0 or -1 if the bookkeeping could not be allocated */
+int VirtualMemory_init (VirtualMemory *vm, Paging *paging,
+		MemoryAllocator *ma, uint32_t start, uint32_t size);
+
+/* Reserves size bytes, rounded up to whole pages, plus a guard page. Returns
+ * the range's address or 0 if no free area is big enough. */
+uint32_t VirtualMemory_reserve (VirtualMemory *vm, size_t size);
+
+/* Ends a reservation, the range must have been unmapped. Returns its size
+ * including the guard page or 0 if address was not reserved. */
+uint32_t VirtualMemory_unreserve (VirtualMemory *vm, uint32_t address);
+
+/* vmalloc and vfree: the memory is not zeroed */
+void *VirtualMemory_alloc (VirtualMemory *vm, size_t size);
+void VirtualMemory_free (VirtualMemory *vm, void *ptr);
+
+void VirtualMemory_print (VirtualMemory *vm);
+
+#endif /* VIRTUAL_MEMORY_H */
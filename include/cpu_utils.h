@@ -1,6 +1,7 @@
 #ifndef CPU_UTILS_H
 #define CPU_UTILS_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 extern __attribute__((cdecl)) __attribute__((noreturn)) void cpu_halt (void);
@@ -14,4 +15,27 @@ extern __attribute__((cdecl)) void hypercall1 (uint32_t nr, uint32_t arg);
 
 extern __attribute__((cdecl)) uint64_t read_tsc (void);
 
+extern __attribute__((cdecl)) void cpu_cpuid (uint32_t leaf, uint32_t regs[4]);
+
+extern __attribute__((cdecl)) uint32_t read_cr4 (void);
+extern __attribute__((cdecl)) void write_cr4 (uint32_t value);
+
+/* Loads a page directory's physical address into CR3, which flushes the
+ * non-global TLB entries */
+extern __attribute__((cdecl)) void set_cr3 (uint32_t pd);
+
+/* Sets CR0.PG and CR0.WP, CR3 must have been loaded */
+extern __attribute__((cdecl)) void enable_paging (void);
+
+extern __attribute__((cdecl)) void invlpg (uint32_t address);
+
+/* Writes back and invalidates all caches, which takes long */
+extern __attribute__((cdecl)) void wbinvd (void);
+
+/* Requires SSE2, size must be a multiple of 16 */
+extern __attribute__((cdecl)) void zero_nt (void *dest, size_t size);
+
+/* CPUID leaf 1 feature flags */
+#define CPUID_1_EDX_SSE2	(1 << 26)
+
 #endif /* CPU_UTILS_H */
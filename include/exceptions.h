@@ -0,0 +1,19 @@
+#ifndef EXCEPTIONS_H
+#define EXCEPTIONS_H
+
+#include <stdint.h>
+
+/* Page fault error code bits */
+#define PAGE_FAULT_PRESENT		0x01
+#define PAGE_FAULT_WRITE		0x02
+#define PAGE_FAULT_USER			0x04
+
+typedef void (*exceptions_page_fault_handler) (uint32_t address,
+		uint32_t error_code);
+
+/* Loads an IDT that calls page_fault on page faults. If page_fault returns,
+ * the faulting instruction is restarted. */
+extern __attribute__((cdecl)) void exceptions_init (
+		exceptions_page_fault_handler page_fault);
+
+#endif /* EXCEPTIONS_H */
@@ -0,0 +1,256 @@
+#ifndef PAGING_H
+#define PAGING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "PageFrameAllocator.h"
+
+/******************************** Usage ***************************************
+ *
+ * Two level i386 paging without PAE: a page directory of PAGING_ENTRIES
+ * entries, each mapping a 4 MiB large page or pointing to a page table of
+ * PAGING_ENTRIES entries that map 4 KiB pages.
+ *
+ * ## Setting up paging
+ *   1. Somehow allocate a Paging structure
+ *   2. Call Paging_init, which allocates the page directory
+ *   3. Set map if frames are not identity mapped
+ *   4. Map the kernel, e.g. with Paging_identity_map
+ *   5. Call Paging_enable
+ *
+ * Paging_init uses 4 MiB pages (PSE) if CPUID reports support for them.
+ * Paging_identity_map then maps every 4 MiB aligned part of a range with a
+ * single directory entry, so the kernel and low memory occupy a few TLB
+ * entries and need no page tables. Without PSE, or for the unaligned ends of
+ * a range, page tables are allocated from the Page Frame Allocator.
+ *
+ * Page tables are accessed through map, hence they must be reachable after
+ * paging is enabled. With identity mapping, this is the case if the memory
+ * the Page Frame Allocator allocates from by default is identity mapped, e.g.
+ * everything below PAGE_FRAME_ALLOCATOR_HIGH_START.
+ *
+ * Paging_map and Paging_unmap change a single 4 KiB page. A page within a
+ * large page cannot be mapped on its own; unmapping an address within a
+ * large page unmaps the whole large page.
+ *
+ * ## Global pages
+ * If CPUID reports support for global pages (PGE), Paging_enable sets
+ * CR4.PGE and PAGING_GLOBAL is honoured; otherwise it is dropped from the
+ * flags. Global TLB entries survive CR3 reloads, hence the kernel's
+ * mappings, which are the same in every address space, should be global.
+ *
+ * ## TLB invalidation
+ * Once paging is enabled, Paging_unmap invalidates the page's TLB entry
+ * right away unless a Paging_flush is passed. Then the page is collected and
+ * Paging_flush_commit invalidates all collected pages at once: with one
+ * invlpg per page, or, if more than PAGING_FLUSH_THRESHOLD pages were
+ * collected, with a full flush, which includes the global entries only if a
+ * global page was collected.
+ *
+ * ## Demand-zero ranges
+ * Paging_reserve reserves a range of virtual addresses without mapping it.
+ * The page fault handler calls Paging_handle_fault, which maps a zeroed
+ * frame at the first touch of each page of a reserved range, so only the
+ * pages that are used take frames. Zeroed frames come from the Page Frame
+ * Allocator's pool of pre-zeroed frames if possible. Paging_release unmaps a
+ * range and frees the frames that were mapped.
+ *
+ * ## Memory types
+ * The memory type of a page, one of PAGING_MEMORY_*, is or-ed into its
+ * flags. If CPUID reports a page attribute table (PAT), Paging_enable
+ * programs it such that PAGING_MEMORY_WRITE_COMBINING selects
+ * write-combining, which suits framebuffers: writes are collected and sent
+ * in bursts, reads are uncached and slow. Without PAT it falls back to
+ * uncached minus, which an MTRR for write-combining may still override.
+ * Device registers must be PAGING_MEMORY_UNCACHED, which the MTRRs cannot
+ * override. Other memory keeps the MTRRs' type, normally write-back.
+ *
+ * Paging_set_memory_type changes the type of mapped pages, splitting large
+ * pages that are only partly covered into page tables.
+ *
+ * Paging does no locking.
+ *
+ *****************************************************************************/
+
+#define PAGING_PAGE_SIZE			0x1000
+#define PAGING_LARGE_PAGE_SIZE		0x400000
+#define PAGING_ENTRIES				1024
+
+/* Flags of directory and table entries */
+#define PAGING_PRESENT				0x001
+#define PAGING_WRITABLE				0x002
+#define PAGING_USER					0x004
+#define PAGING_WRITE_THROUGH		0x008
+#define PAGING_CACHE_DISABLE		0x010
+#define PAGING_ACCESSED				0x020
+#define PAGING_DIRTY				0x040
+#define PAGING_LARGE				0x080	/* Directory entries only */
+#define PAGING_GLOBAL				0x100
+
+/* Memory types: the PAT index selected by the write-through and cache
+ * disable flags. The PAT flag is not used, hence PAT entries 4 to 7 repeat
+ * 0 to 3. */
+#define PAGING_MEMORY_WRITE_BACK		0x000
+#define PAGING_MEMORY_WRITE_COMBINING	PAGING_WRITE_THROUGH
+#define PAGING_MEMORY_UNCACHED_MINUS	PAGING_CACHE_DISABLE
+#define PAGING_MEMORY_UNCACHED			(PAGING_WRITE_THROUGH | PAGING_CACHE_DISABLE)
+#define PAGING_MEMORY_TYPE_MASK			(PAGING_WRITE_THROUGH | PAGING_CACHE_DISABLE)
+
+/* PAT entries: write-back, write-combining, uncached minus, uncached */
+#define PAGING_PAT_VALUE			0x0007010600070106ULL
+
+#define PAGING_FLAGS_MASK			0x00000fff
+#define PAGING_ADDRESS_MASK			0xfffff000
+#define PAGING_LARGE_ADDRESS_MASK	0xffc00000
+
+#define PAGING_DIRECTORY_INDEX(VIRTUAL)	((uint32_t) (VIRTUAL) >> 22)
+#define PAGING_TABLE_INDEX(VIRTUAL)		(((uint32_t) (VIRTUAL) >> 12) & 0x3ff)
+
+/* Control register bits */
+#define PAGING_CR0_WP				0x00010000
+#define PAGING_CR0_PG				0x80000000
+#define PAGING_CR4_PSE				0x00000010
+#define PAGING_CR4_PGE				0x00000080
+
+/* CPUID leaf 1 EDX: page size extension, global pages and page attribute
+ * table */
+#define CPUID_1_EDX_PSE				(1 << 3)
+#define CPUID_1_EDX_PGE				(1 << 13)
+#define CPUID_1_EDX_PAT				(1 << 16)
+
+/* Above this number of pages, a full flush is cheaper than invlpg per page
+ * plus the misses to refill the flushed entries */
+#define PAGING_FLUSH_THRESHOLD		32
+
+/* Maximum number of demand-zero ranges */
+#define PAGING_RANGE_COUNT			8
+
+typedef uint32_t pde;
+typedef uint32_t pte;
+
+/* A demand-zero range of virtual addresses */
+typedef struct _Paging_range Paging_range;
+struct _Paging_range
+{
+	uint32_t start;
+	uint32_t size;
+
+	/* Flags of the pages mapped on faults, 0 if the entry is unused */
+	uint32_t flags;
+
+	/* Number of pages mapped */
+	uint32_t page_count;
+};
+
+typedef struct _Paging Paging;
+struct _Paging
+{
+	PageFrameAllocator *pfa;
+
+	/* Returns a pointer to the frames at a physical address. If NULL, frames
+	 * are assumed to be identity mapped. */
+	void *(*map) (uint64_t address);
+
+	/* Physical address of the page directory, loaded into CR3 */
+	uint32_t directory_address;
+
+	/* Whether 4 MiB pages, global pages and the PAT are used and whether
+	 * paging is enabled */
+	uint8_t large_pages;
+	uint8_t global_pages;
+	uint8_t pat;
+	uint8_t enabled;
+
+	Paging_range ranges[PAGING_RANGE_COUNT];
+
+	/* Statistics */
+	uint32_t table_count;
+	uint32_t large_page_count;
+	uint32_t page_count;
+	uint32_t invalidations;
+	uint32_t full_flushes;
+	uint32_t demand_faults;
+	uint32_t large_page_splits;
+};
+
+/* Pages whose TLB entries are to be invalidated together */
+typedef struct _Paging_flush Paging_flush;
+struct _Paging_flush
+{
+	/* Number of pages collected, only the first PAGING_FLUSH_THRESHOLD are
+	 * recorded */
+	uint32_t count;
+	uint32_t pages[PAGING_FLUSH_THRESHOLD];
+
+	/* Whether a global page was collected */
+	uint8_t global;
+};
+
+/* Public API */
+
+/* Allocates the page directory. Returns 0 or -1 if no frame is free. */
+int Paging_init (Paging *paging, PageFrameAllocator *pfa);
+
+/* Maps size bytes at start to the same physical addresses, with large pages
+ * where possible. start and size are rounded to whole pages. Returns 0 or -1
+ * if a page table could not be allocated or a page is mapped already. */
+int Paging_identity_map (Paging *paging, uint32_t start, uint32_t size,
+		uint32_t flags);
+
+/* Map a 4 KiB page respectively a 4 MiB page (which requires large_pages).
+ * Both addresses must be aligned to the page size. Return 0 or -1 if a page
+ * table could not be allocated or the address is mapped already. */
+int Paging_map (Paging *paging, uint32_t virtual, uint64_t physical,
+		uint32_t flags);
+int Paging_map_large (Paging *paging, uint32_t virtual, uint64_t physical,
+		uint32_t flags);
+
+/* Unmaps the page containing virtual. Its TLB entry is invalidated right
+ * away if flush is NULL, otherwise it is added to flush. Returns 0 or -1 if
+ * it is not mapped. */
+int Paging_unmap (Paging *paging, uint32_t virtual, Paging_flush *flush);
+
+/* Looks up the physical address virtual is mapped to. Returns 0 or -1 if
+ * virtual is not mapped. */
+int Paging_translate (Paging *paging, uint32_t virtual, uint64_t *physical);
+
+/* Sets the memory type of the mapped pages in size bytes at start (rounded
+ * to whole pages) to type, one of PAGING_MEMORY_*. Returns 0 or -1 if a page
+ * is not mapped or a large page could not be split. */
+int Paging_set_memory_type (Paging *paging, uint32_t start, uint32_t size,
+		uint32_t type);
+
+/* Programs the PAT if used, loads the page directory and turns on paging
+ * (and PSE and PGE if used) */
+void Paging_enable (Paging *paging);
+
+void Paging_flush_init (Paging_flush *flush);
+void Paging_flush_add (Paging_flush *flush, uint32_t virtual, int global);
+
+/* Invalidates the collected pages and empties flush */
+void Paging_flush_commit (Paging *paging, Paging_flush *flush);
+
+/* Flushes the whole TLB, including the global entries if global is set */
+void Paging_flush_all (Paging *paging, int global);
+
+/* Reserves size bytes at start (rounded to whole pages) to be mapped on
+ * demand with flags. Returns 0 or -1 if the range is empty, does not end at
+ * or below 4 GiB, overlaps a reserved one or PAGING_RANGE_COUNT ranges are
+ * reserved already. */
+int Paging_reserve (Paging *paging, uint32_t start, uint32_t size,
+		uint32_t flags);
+
+/* Unmaps the reserved range starting at start, frees its frames and ends the
+ * reservation. Returns 0 or -1 if no range starts at start. */
+int Paging_release (Paging *paging, uint32_t start);
+
+/* Maps a zeroed frame if address lies in a reserved range and is not
+ * mapped yet. To be called by the page fault handler with the faulting
+ * address and the error code. Returns 0 if the fault was resolved, -1
+ * otherwise. */
+int Paging_handle_fault (Paging *paging, uint32_t address,
+		uint32_t error_code);
+
+void Paging_print (Paging *paging);
+
+#endif /* PAGING_H */
@@ -0,0 +1,125 @@
+#include "AllocationProfile.h"
+#include "stdio.h"
+#include "string.h"
+
+static uint32_t AllocationProfile_hash (void *caller);
+
+
+void AllocationProfile_init (AllocationProfile *profile)
+{
+	profile->clock = NULL;
+
+	bzero (profile->sites, sizeof (profile->sites));
+}
+
+uint32_t AllocationProfile_allocated (AllocationProfile *profile,
+		void *caller, size_t size)
+{
+	uint32_t index = AllocationProfile_hash (caller);
+	uint32_t probes;
+
+	/* Linear probing, sites are never removed */
+	for (probes = 0; probes < ALLOCATION_PROFILE_SITES; probes++)
+	{
+		AllocationProfile_site *site = &profile->sites[index];
+
+		if (site->caller == caller)
+			break;
+
+		if (!site->caller)
+		{
+			site->caller = caller;
+			site->first_seen = profile->clock ? profile->clock () : 0;
+			break;
+		}
+
+		index = (index + 1) & (ALLOCATION_PROFILE_SITES - 1);
+	}
+
+	if (probes == ALLOCATION_PROFILE_SITES)
+		index = ALLOCATION_PROFILE_SITES;
+
+	AllocationProfile_site *site = &profile->sites[index];
+
+	site->allocations++;
+	site->allocated_bytes += size;
+	site->live_bytes += size;
+
+	if (site->live_bytes > site->peak_live_bytes)
+		site->peak_live_bytes = site->live_bytes;
+
+	return index;
+}
+
+void AllocationProfile_freed (AllocationProfile *profile, uint32_t site,
+		size_t size)
+{
+	profile->sites[site].frees++;
+	profile->sites[site].live_bytes -= size;
+}
+
+void AllocationProfile_print (AllocationProfile *profile, unsigned int top)
+{
+	uint8_t printed[ALLOCATION_PROFILE_SITES + 1] = {0};
+	uint64_t now = profile->clock ? profile->clock () : 0;
+
+	printf ("Allocation profile, top %d sites by live bytes:\n", (int) top);
+
+	/* Selection of the top sites, which are few */
+	for (unsigned int n = 0; n < top; n++)
+	{
+		int best = -1;
+
+		for (int i = 0; i <= ALLOCATION_PROFILE_SITES; i++)
+		{
+			if (printed[i] || profile->sites[i].allocations == 0)
+				continue;
+
+			/* Ties go to the site that allocates more often */
+			if (best < 0 ||
+					profile->sites[i].live_bytes > profile->sites[best].live_bytes ||
+					(profile->sites[i].live_bytes == profile->sites[best].live_bytes &&
+					 profile->sites[i].allocations > profile->sites[best].allocations))
+				best = i;
+		}
+
+		if (best < 0)
+			break;
+
+		printed[best] = 1;
+
+		AllocationProfile_site *site = &profile->sites[best];
+
+		/* Allocations per million clock ticks since the site's first one */
+		uint64_t rate = 0;
+
+		if (now > site->first_seen)
+			rate = site->allocations * 1000000ULL / (now - site->first_seen);
+
+		printf ("  %p: %d live bytes (peak %d), %d allocations, %d frees, "
+				"%d bytes allocated, %d/Mtick\n",
+				site->caller,
+				(int) site->live_bytes,
+				(int) site->peak_live_bytes,
+				(int) site->allocations,
+				(int) site->frees,
+				(int) site->allocated_bytes,
+				(int) rate);
+	}
+}
+
+
+/* Function:   AllocationProfile_hash
+ * Purpose:    to map a call site to its first slot in the site table
+ * Parameters: caller: The call site's return address
+ * Returns:    An index below ALLOCATION_PROFILE_SITES */
+static uint32_t AllocationProfile_hash (void *caller)
+{
+	uint32_t h = (uint32_t) (uintptr_t) caller;
+
+	h ^= h >> 16;
+	h *= 0x45d9f3b;
+	h ^= h >> 16;
+
+	return h & (ALLOCATION_PROFILE_SITES - 1);
+}
@@ -0,0 +1,179 @@
+#include "Arena.h"
+#include "utils.h"
+
+static void *Arena_fit (Arena *arena, size_t size, size_t alignment);
+
+static Arena_chunk *Arena_get_chunk (Arena *arena, uint32_t frame_count);
+
+static void Arena_put_chunk (Arena *arena, Arena_chunk *chunk);
+
+
+void Arena_init (Arena *arena, PageFrameAllocator *pfa)
+{
+	arena->pfa = pfa;
+	arena->map = NULL;
+	arena->current = NULL;
+	arena->top = NULL;
+	arena->spare = NULL;
+	arena->chunk_count = 0;
+	arena->allocated = 0;
+}
+
+void *Arena_alloc (Arena *arena, size_t size)
+{
+	return Arena_alloc_aligned (arena, size, ARENA_ALIGNMENT);
+}
+
+void *Arena_alloc_aligned (Arena *arena, size_t size, size_t alignment)
+{
+	if (size == 0 || (alignment & (alignment - 1)) ||
+			alignment > arena->pfa->frame_size)
+		return NULL;
+
+	if (alignment < ARENA_ALIGNMENT)
+		alignment = ARENA_ALIGNMENT;
+
+	void *object = Arena_fit (arena, size, alignment);
+
+	if (object)
+		return object;
+
+	/* Chain a new chunk, the rest of the current one is left unused */
+	uint64_t chunk_size = ((sizeof (Arena_chunk) + alignment - 1) &
+			~(alignment - 1)) + (uint64_t) size;
+	uint64_t frame_count = (chunk_size + arena->pfa->frame_size - 1) /
+		arena->pfa->frame_size;
+
+	if (frame_count > PAGE_FRAME_ALLOCATOR_NO_FRAME)
+		return NULL;
+
+	Arena_chunk *chunk = Arena_get_chunk (arena,
+			MAX (frame_count, ARENA_CHUNK_FRAMES));
+
+	if (!chunk)
+		return NULL;
+
+	chunk->previous = arena->current;
+	arena->current = chunk;
+	arena->top = (uint8_t *) (chunk + 1);
+
+	return Arena_fit (arena, size, alignment);
+}
+
+Arena_mark Arena_get_mark (Arena *arena)
+{
+	Arena_mark mark;
+
+	mark.chunk = arena->current;
+	mark.top = arena->top;
+	mark.allocated = arena->allocated;
+
+	return mark;
+}
+
+void Arena_rewind (Arena *arena, Arena_mark mark)
+{
+	/* Drop the chunks chained after the mark */
+	while (arena->current != mark.chunk)
+	{
+		Arena_chunk *previous = arena->current->previous;
+
+		Arena_put_chunk (arena, arena->current);
+		arena->current = previous;
+	}
+
+	arena->top = mark.top;
+	arena->allocated = mark.allocated;
+}
+
+void Arena_release (Arena *arena)
+{
+	Arena_mark empty = {NULL, NULL, 0};
+
+	Arena_rewind (arena, empty);
+
+	if (arena->spare)
+	{
+		PageFrameAllocator_free_range (arena->pfa, arena->spare->address,
+				arena->spare->frame_count);
+		arena->spare = NULL;
+	}
+}
+
+
+/* Function:   Arena_fit
+ * Purpose:    to allocate an object from the free space of the current chunk
+ * Parameters: arena:     The arena
+ *             size:      The object's size
+ *             alignment: The object's alignment, a power of 2
+ * Returns:    The object or NULL if it does not fit */
+static void *Arena_fit (Arena *arena, size_t size, size_t alignment)
+{
+	if (!arena->current)
+		return NULL;
+
+	uintptr_t object = ((uintptr_t) arena->top + alignment - 1) &
+		~((uintptr_t) alignment - 1);
+	uintptr_t end = (uintptr_t) arena->current->end;
+
+	if (object > end || size > end - object)
+		return NULL;
+
+	arena->top = (uint8_t *) (object + size);
+	arena->allocated += size;
+
+	return (void *) object;
+}
+
+/* Function:   Arena_get_chunk
+ * Purpose:    to allocate a chunk, preferably the spare one, and to
+ *             initialize its header
+ * Parameters: arena:       The arena
+ *             frame_count: The chunk's size in frames
+ * Returns:    The chunk or NULL if there are not enough free frames */
+static Arena_chunk *Arena_get_chunk (Arena *arena, uint32_t frame_count)
+{
+	Arena_chunk *chunk;
+
+	if (frame_count == ARENA_CHUNK_FRAMES && arena->spare)
+	{
+		chunk = arena->spare;
+		arena->spare = NULL;
+	}
+	else
+	{
+		uint64_t address = PageFrameAllocator_allocate_range (
+				arena->pfa, frame_count, 1);
+
+		if (!address)
+			return NULL;
+
+		chunk = arena->map ?
+			arena->map (address) : (void *) (uintptr_t) address;
+
+		chunk->address = address;
+		chunk->frame_count = frame_count;
+		chunk->end = (uint8_t *) chunk + frame_count * arena->pfa->frame_size;
+	}
+
+	chunk->previous = NULL;
+	arena->chunk_count++;
+
+	return chunk;
+}
+
+/* Function:   Arena_put_chunk
+ * Purpose:    to keep a chunk as the spare one or to return its frames to the
+ *             Page Frame Allocator
+ * Parameters: arena: The arena
+ *             chunk: The chunk */
+static void Arena_put_chunk (Arena *arena, Arena_chunk *chunk)
+{
+	arena->chunk_count--;
+
+	if (chunk->frame_count == ARENA_CHUNK_FRAMES && !arena->spare)
+		arena->spare = chunk;
+	else
+		PageFrameAllocator_free_range (arena->pfa, chunk->address,
+				chunk->frame_count);
+}
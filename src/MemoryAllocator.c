@@ -1,89 +1,324 @@
 #include "MemoryAllocator.h"
 
+_Static_assert (sizeof (MemoryAllocator_slab) <= MEMORY_ALLOCATOR_HEADER_SIZE,
+		"MemoryAllocator_slab does not fit into the header space");
+
+static MemoryAllocator_slab *MemoryAllocator_get_frames (
+		MemoryAllocator *ma, uint32_t frame_count);
+
+static void MemoryAllocator_put_frames (
+		MemoryAllocator *ma, MemoryAllocator_slab *slab);
+
+static MemoryAllocator_slab *MemoryAllocator_new_slab (
+		MemoryAllocator *ma, uint32_t object_size);
+
+static void MemoryAllocator_unlink (
+		MemoryAllocator_class *class, MemoryAllocator_slab *slab);
+
+static inline void *MemoryAllocator_alloc_object (
+		MemoryAllocator *ma, size_t size);
+
+static inline void MemoryAllocator_free_object (
+		MemoryAllocator *ma, void *ptr);
+
+
 void MemoryAllocator_init (MemoryAllocator *ma, PageFrameAllocator *pfa)
 {
 	ma->pfa = pfa;
-	ma->allocated_ranges = NULL;
-	ma->free_ranges = NULL;
+	ma->map = NULL;
+
+	for (int i = 0; i < MEMORY_ALLOCATOR_CLASS_COUNT; i++)
+	{
+		ma->classes[i].partial = NULL;
+		ma->classes[i].empty_slabs = 0;
+	}
+
+#ifdef MEMORY_ALLOCATOR_PROFILE
+	AllocationProfile_init (&ma->profile);
+#endif
 }
 
 void *MemoryAllocator_alloc (MemoryAllocator *ma, size_t size)
 {
-	/* Look if there is a chunk of free memory left that fits the requested
-	 * size (first fit). */
-	MemoryAllocator_range *free_range = ma->free_ranges;
+	if (size == 0)
+		return NULL;
 
-	while (free_range)
-	{
-		if (free_range->size >= size)
-			break;
+#ifdef MEMORY_ALLOCATOR_PROFILE
+	MemoryAllocator_profile_tag *tag = MemoryAllocator_alloc_object (
+			ma, size + MEMORY_ALLOCATOR_PROFILE_TAG_SIZE);
 
-		free_range = free_range->next;
-	}
+	if (!tag)
+		return NULL;
+
+	tag->size = size;
+	tag->site = AllocationProfile_allocated (
+			&ma->profile, __builtin_return_address (0), size);
+
+	return (uint8_t *) tag + MEMORY_ALLOCATOR_PROFILE_TAG_SIZE;
+#else
+	return MemoryAllocator_alloc_object (ma, size);
+#endif
+}
+
+void MemoryAllocator_free (MemoryAllocator *ma, void *ptr)
+{
+	if (!ptr)
+		return;
 
-	if (free_range)
+#ifdef MEMORY_ALLOCATOR_PROFILE
+	MemoryAllocator_profile_tag *tag = (MemoryAllocator_profile_tag *)
+		((uint8_t *) ptr - MEMORY_ALLOCATOR_PROFILE_TAG_SIZE);
+
+	AllocationProfile_freed (&ma->profile, tag->site, tag->size);
+	ptr = tag;
+#endif
+
+	MemoryAllocator_free_object (ma, ptr);
+}
+
+void MemoryAllocator_trim (MemoryAllocator *ma)
+{
+	for (int i = 0; i < MEMORY_ALLOCATOR_CLASS_COUNT; i++)
 	{
-		MemoryAllocator_range *allocated_range;
+		MemoryAllocator_class *class = &ma->classes[i];
+		MemoryAllocator_slab *slab = class->partial;
 
-		/* If the range is big enough to take a part of it for a new free block's
-		 * description, do that. */
-		if (free_range->size > size + sizeof (*free_range))
+		while (slab && class->empty_slabs > 0)
 		{
-			/* Split the free block */
-			allocated_range = (void *) free_range->begin + size;
-			free_range->begin = allocated_range + sizeof (*allocated_range);
-			free_range->size = free_range->size - size - sizeof (*allocated_range);
-			allocated_range->size = size;
+			MemoryAllocator_slab *next = slab->next;
+
+			if (slab->used == 0)
+			{
+				MemoryAllocator_unlink (class, slab);
+				MemoryAllocator_put_frames (ma, slab);
+				class->empty_slabs--;
+			}
+
+			slab = next;
 		}
-		else
-		{
-			/* Remove the free block from the list of free blocks */
-			if (free_range->previous)
-				free_range->previous = free_range->next;
+	}
+}
 
-			if (free_range->next)
-				free_range->next->previous = free_range->previous;
+#ifdef MEMORY_ALLOCATOR_PROFILE
+void MemoryAllocator_print_profile (MemoryAllocator *ma, unsigned int top)
+{
+	AllocationProfile_print (&ma->profile, top);
+}
+#endif
 
-			if (free_range == ma->free_ranges)
-				ma->free_ranges = free_range;
 
-			allocated_range = free_range;
-		}
+/* Function:   MemoryAllocator_alloc_object
+ * Purpose:    to allocate an object from its size class' slabs or, if it is
+ *             big, a run of frames of its own
+ * Parameters: ma:   The memory allocator
+ *             size: The object's size, not 0
+ * Returns:    The object or NULL if there are not enough free frames */
+static inline void *MemoryAllocator_alloc_object (
+		MemoryAllocator *ma, size_t size)
+{
+	/* Big requests get frames of their own */
+	if (size > MEMORY_ALLOCATOR_MAX_SIZE)
+	{
+		uint32_t frame_count = (size + MEMORY_ALLOCATOR_HEADER_SIZE +
+				ma->pfa->frame_size - 1) / ma->pfa->frame_size;
 
-		/* Hook the allocated block into the list of allocated blocks */
-		allocated_range->previous = NULL;
+		MemoryAllocator_slab *slab = MemoryAllocator_get_frames (ma, frame_count);
 
-		if (!ma->allocated_ranges)
-		{
-			allocated_range->next = NULL;
-		}
-		else
-		{
-			allocated_range->next = ma->allocated_ranges;
-			allocated_range->next->previous = allocated_range;
-		}
+		if (!slab)
+			return NULL;
+
+		slab->object_size = 0;
+		slab->used = 1;
 
-		ma->allocated_ranges = allocated_range;
+		return (uint8_t *) slab + MEMORY_ALLOCATOR_HEADER_SIZE;
 	}
-	else
+
+	/* Size class */
+	int shift = MEMORY_ALLOCATOR_MIN_SHIFT;
+
+	while ((1U << shift) < size)
+		shift++;
+
+	MemoryAllocator_class *class =
+		&ma->classes[shift - MEMORY_ALLOCATOR_MIN_SHIFT];
+
+	MemoryAllocator_slab *slab = class->partial;
+
+	if (!slab)
 	{
-		uint32_t page_frame_count = (size + ma->pfa->frame_size - 1) /
-			ma->pfa->frame_size;
-		
-		/* Check if enough page frames are free */
-		if (!PageFrameAllocator_check_frames_available (ma->pfa, page_frame_count))
+		slab = MemoryAllocator_new_slab (ma, 1U << shift);
+
+		if (!slab)
 			return NULL;
 
-		/* If so, allocate and map them. */
-		for (uint32_t i = 0; i < page_frame_count; i++)
-		{
-			PageFrameAllocator_allocate (ma->pfa);
-		}
+		class->partial = slab;
+		class->empty_slabs++;
+	}
+
+	/* Take a freed object or, if there is none, an unused one */
+	void *object;
+
+	if (slab->free)
+	{
+		object = slab->free;
+		slab->free = slab->free->next;
 	}
+	else
+	{
+		object = slab->unused;
+		slab->unused += slab->object_size;
+	}
+
+	if (slab->used++ == 0)
+		class->empty_slabs--;
+
+	/* Full slabs are not kept in any list */
+	if (!slab->free && slab->unused + slab->object_size > slab->end)
+		MemoryAllocator_unlink (class, slab);
 
-	return NULL;
+	return object;
 }
 
-void MemoryAllocator_free (MemoryAllocator *ma, void *ptr)
+/* Function:   MemoryAllocator_free_object
+ * Purpose:    to return an object to its slab, or a big request's frames to
+ *             the Page Frame Allocator
+ * Parameters: ma:  The memory allocator
+ *             ptr: The object, not NULL */
+static inline void MemoryAllocator_free_object (
+		MemoryAllocator *ma, void *ptr)
+{
+	MemoryAllocator_slab *slab = (MemoryAllocator_slab *)
+		((uintptr_t) ptr & ~((uintptr_t) MEMORY_ALLOCATOR_SLAB_SIZE - 1));
+
+	if (slab->magic != MEMORY_ALLOCATOR_MAGIC || slab->used == 0)
+		return;
+
+	if (slab->object_size == 0)
+	{
+		MemoryAllocator_put_frames (ma, slab);
+		return;
+	}
+
+	int shift = __builtin_ctz (slab->object_size);
+	MemoryAllocator_class *class =
+		&ma->classes[shift - MEMORY_ALLOCATOR_MIN_SHIFT];
+
+	/* A full slab gets a free object now */
+	if (!slab->free && slab->unused + slab->object_size > slab->end)
+	{
+		slab->previous = NULL;
+		slab->next = class->partial;
+
+		if (class->partial)
+			class->partial->previous = slab;
+
+		class->partial = slab;
+	}
+
+	MemoryAllocator_object *object = ptr;
+
+	object->next = slab->free;
+	slab->free = object;
+
+	if (--slab->used > 0)
+		return;
+
+	/* The slab is empty, keep one per size class */
+	if (class->empty_slabs > 0)
+	{
+		MemoryAllocator_unlink (class, slab);
+		MemoryAllocator_put_frames (ma, slab);
+	}
+	else
+	{
+		class->empty_slabs++;
+	}
+}
+
+/* Function:   MemoryAllocator_get_frames
+ * Purpose:    to allocate a run of frames that is aligned to the slab size
+ *             and to initialize the header at its beginning
+ * Parameters: ma:          The memory allocator
+ *             frame_count: The run's length
+ * Returns:    The header or NULL if there are not enough free frames */
+static MemoryAllocator_slab *MemoryAllocator_get_frames (
+		MemoryAllocator *ma, uint32_t frame_count)
+{
+	uint64_t address = PageFrameAllocator_allocate_range (
+			ma->pfa, frame_count, MEMORY_ALLOCATOR_SLAB_FRAMES);
+
+	if (!address)
+		return NULL;
+
+	MemoryAllocator_slab *slab = ma->map ?
+		ma->map (address) : (void *) (uintptr_t) address;
+
+	slab->magic = MEMORY_ALLOCATOR_MAGIC;
+	slab->address = address;
+	slab->frame_count = frame_count;
+	slab->used = 0;
+	slab->next = NULL;
+	slab->previous = NULL;
+	slab->free = NULL;
+	slab->unused = (uint8_t *) slab + MEMORY_ALLOCATOR_HEADER_SIZE;
+	slab->end = (uint8_t *) slab + frame_count * ma->pfa->frame_size;
+
+	if (ma->pfa->pages)
+	{
+		PageFrameAllocator_set_owner (ma->pfa, address, frame_count,
+				PAGE_FRAME_ALLOCATOR_OWNER_MEMORY_ALLOCATOR, slab);
+	}
+
+	return slab;
+}
+
+/* Function:   MemoryAllocator_put_frames
+ * Purpose:    to return a slab's or big request's frames to the Page Frame
+ *             Allocator
+ * Parameters: ma:   The memory allocator
+ *             slab: The header at the frames' beginning */
+static void MemoryAllocator_put_frames (
+		MemoryAllocator *ma, MemoryAllocator_slab *slab)
 {
+	/* Catch double frees */
+	slab->magic = 0;
+
+	PageFrameAllocator_free_range (ma->pfa, slab->address, slab->frame_count);
+}
+
+/* Function:   MemoryAllocator_new_slab
+ * Purpose:    to allocate an empty slab
+ * Parameters: ma:          The memory allocator
+ *             object_size: The size class
+ * Returns:    The slab or NULL if there are not enough free frames */
+static MemoryAllocator_slab *MemoryAllocator_new_slab (
+		MemoryAllocator *ma, uint32_t object_size)
+{
+	MemoryAllocator_slab *slab = MemoryAllocator_get_frames (
+			ma, MEMORY_ALLOCATOR_SLAB_FRAMES);
+
+	if (slab)
+		slab->object_size = object_size;
+
+	return slab;
+}
+
+/* Function:   MemoryAllocator_unlink
+ * Purpose:    to remove a slab from its size class' list of slabs with free
+ *             objects
+ * Parameters: class: The size class
+ *             slab:  The slab */
+static void MemoryAllocator_unlink (
+		MemoryAllocator_class *class, MemoryAllocator_slab *slab)
+{
+	if (slab->previous)
+		slab->previous->next = slab->next;
+	else
+		class->partial = slab->next;
+
+	if (slab->next)
+		slab->next->previous = slab->previous;
+
+	slab->next = NULL;
+	slab->previous = NULL;
 }
@@ -1,96 +1,1536 @@
 #include "PageFrameAllocator.h"
 #include "stdio.h"
+#include "string.h"
+#include "utils.h"
+
+/* Static prototypes */
+static uint32_t PageFrameAllocator_find_free (
+		PageFrameAllocator *pfa, uint32_t first_word, uint32_t last_word,
+		uint32_t mask);
+
+static uint32_t PageFrameAllocator_find_used (
+		PageFrameAllocator *pfa, uint32_t first_frame, uint32_t count);
+
+static PageFrameAllocator_zone *PageFrameAllocator_zone_of (
+		PageFrameAllocator *pfa, uint32_t frame);
+
+static uint32_t PageFrameAllocator_zone_find_free (
+		PageFrameAllocator *pfa, PageFrameAllocator_zone *zone);
+
+static uint32_t PageFrameAllocator_zone_find_free_packed (
+		PageFrameAllocator *pfa, PageFrameAllocator_zone *zone);
+
+static uint32_t PageFrameAllocator_zone_allocate_range (
+		PageFrameAllocator *pfa, PageFrameAllocator_zone *zone,
+		uint32_t count, uint32_t alignment);
+
+static uint32_t PageFrameAllocator_allocate_frame (
+		PageFrameAllocator *pfa, uint32_t flags);
+
+static uint64_t PageFrameAllocator_zero_pool_take (
+		PageFrameAllocator *pfa, uint32_t flags);
+
+static void PageFrameAllocator_zero (
+		PageFrameAllocator *pfa, uint64_t address, uint32_t count);
+
+static void PageFrameAllocator_account (
+		PageFrameAllocator *pfa, uint32_t frames, uint32_t scan_start);
+
+static inline void PageFrameAllocator_pages_allocated (
+		PageFrameAllocator *pfa, uint32_t first_frame, uint32_t count);
+
+static inline void PageFrameAllocator_pages_freed (
+		PageFrameAllocator *pfa, uint32_t first_frame, uint32_t count);
+
+static int PageFrameAllocator_bitmap_set (PageFrameAllocator *pfa, uint32_t frame);
+static int PageFrameAllocator_bitmap_clear (PageFrameAllocator *pfa, uint32_t frame);
+
+static uint32_t PageFrameAllocator_bitmap_fill_words (
+		PageFrameAllocator *pfa, uint32_t first_frame, uint32_t end_frame,
+		int used);
+
+static void PageFrameAllocator_bitmap_fill (
+		PageFrameAllocator *pfa, uint32_t first_frame, uint32_t count, int used);
+
+static void PageFrameAllocator_buddy_push (
+		PageFrameAllocator *pfa, uint32_t frame, uint8_t order);
+
+static void PageFrameAllocator_buddy_remove (PageFrameAllocator *pfa, uint32_t frame);
+
+static void PageFrameAllocator_buddy_release (
+		PageFrameAllocator *pfa, uint32_t frame, uint8_t order);
+
+static void PageFrameAllocator_buddy_release_range (
+		PageFrameAllocator *pfa, uint32_t first_frame, uint32_t count);
+
+static uint32_t PageFrameAllocator_buddy_take (
+		PageFrameAllocator *pfa, PageFrameAllocator_zone *zone, uint8_t order);
+static void PageFrameAllocator_buddy_carve (PageFrameAllocator *pfa, uint32_t frame);
+static void PageFrameAllocator_buddy_carve_range (
+		PageFrameAllocator *pfa, uint32_t first_frame, uint32_t count);
+
+/* Zones to try for each preferred zone, in order. Each list is terminated by
+ * PAGE_FRAME_ALLOCATOR_ZONE_COUNT. */
+static const uint8_t PageFrameAllocator_fallback
+	[PAGE_FRAME_ALLOCATOR_ZONE_COUNT][PAGE_FRAME_ALLOCATOR_ZONE_COUNT + 1] =
+{
+	[PAGE_FRAME_ALLOCATOR_ZONE_DMA] = {
+		PAGE_FRAME_ALLOCATOR_ZONE_DMA,
+		PAGE_FRAME_ALLOCATOR_ZONE_COUNT
+	},
+
+	[PAGE_FRAME_ALLOCATOR_ZONE_NORMAL] = {
+		PAGE_FRAME_ALLOCATOR_ZONE_NORMAL,
+		PAGE_FRAME_ALLOCATOR_ZONE_DMA,
+		PAGE_FRAME_ALLOCATOR_ZONE_COUNT
+	},
+
+	[PAGE_FRAME_ALLOCATOR_ZONE_HIGH] = {
+		PAGE_FRAME_ALLOCATOR_ZONE_HIGH,
+		PAGE_FRAME_ALLOCATOR_ZONE_NORMAL,
+		PAGE_FRAME_ALLOCATOR_ZONE_DMA,
+		PAGE_FRAME_ALLOCATOR_ZONE_COUNT
+	}
+};
 
 void PageFrameAllocator_init_bitmap (PageFrameAllocator *pfa)
 {
-	SystemMemoryMap mmap = pfa->mmap;
+	/* Start with all frames used, including the summary bits that do not
+	 * correspond to a bitmap word, so that searches never descend into
+	 * them. */
+	uint32_t *words = (uint32_t *) pfa->bitmap;
+
+	for (unsigned int i = 0; i < pfa->bitmap_size / 4; i++)
+		words[i] = 0xffffffff;
+
+	for (unsigned int i = 0; i < pfa->summary_size / 4; i++)
+		pfa->summary[i] = 0xffffffff;
+
+	pfa->free_frame_count = 0;
+	pfa->zero_pool_count = 0;
+
+	pfa->stats.allocations = 0;
+	pfa->stats.failures = 0;
+	pfa->stats.allocated_frames = 0;
+	pfa->stats.freed_frames = 0;
+	pfa->stats.zero_pool_hits = 0;
+	pfa->stats.scanned_words = 0;
+	pfa->stats.max_scanned_words = 0;
+
+	/* Split the memory into zones */
+	uint32_t boundaries[PAGE_FRAME_ALLOCATOR_ZONE_COUNT + 1] = {
+		0,
+		PAGE_FRAME_ALLOCATOR_DMA_LIMIT / pfa->frame_size,
+		PAGE_FRAME_ALLOCATOR_HIGH_START / pfa->frame_size,
+		pfa->frame_count
+	};
+
+	for (int z = 0; z < PAGE_FRAME_ALLOCATOR_ZONE_COUNT; z++)
+	{
+		PageFrameAllocator_zone *zone = &pfa->zones[z];
+
+		zone->first_frame = MIN (boundaries[z], pfa->frame_count);
+		zone->end_frame = MIN (boundaries[z + 1], pfa->frame_count);
+		zone->free_frame_count = 0;
+		zone->next_free_hint = zone->first_frame;
+
+		for (uint8_t order = 0; order <= PAGE_FRAME_ALLOCATOR_BUDDY_MAX_ORDER; order++)
+			zone->buddy_free[order] = PAGE_FRAME_ALLOCATOR_NO_FRAME;
+	}
 
-	/* Zero the whole bitmap */
-	for (unsigned int i = 0; i < pfa->bitmap_size; i++)
-		pfa->bitmap[i] = 0;
+	if (pfa->backend == PAGE_FRAME_ALLOCATOR_BUDDY)
+	{
+		for (uint32_t i = 0; i < pfa->frame_count; i++)
+			pfa->buddy_nodes[i].order = PAGE_FRAME_ALLOCATOR_BUDDY_NOT_FREE;
+	}
 
-	/* Mark used and reserved frames as used */
-	while (mmap)
+	if (pfa->pages)
 	{
-		if (mmap->type == SYSTEM_MEMORY_MAP_ENTRY_FREE)
+		for (int z = 0; z < PAGE_FRAME_ALLOCATOR_ZONE_COUNT; z++)
 		{
-			uint32_t lowest_frame = mmap->start / pfa->frame_size;
-			uint32_t highest_frame = (mmap->start + mmap->size) / pfa->frame_size ;
+			PageFrameAllocator_zone *zone = &pfa->zones[z];
 
-			for (uint32_t i = lowest_frame; i <= highest_frame; i++)
-				PageFrameAllocator_mark_used (pfa, i);
+			for (uint32_t i = zone->first_frame; i < zone->end_frame; i++)
+			{
+				pfa->pages[i].private = NULL;
+				pfa->pages[i].refcount = 0;
+				pfa->pages[i].flags = 0;
+				pfa->pages[i].zone = z;
+				pfa->pages[i].owner = PAGE_FRAME_ALLOCATOR_OWNER_NONE;
+			}
 		}
+	}
+
+	if (pfa->huge_free)
+	{
+		uint32_t runs = (pfa->frame_count + pfa->huge_frames - 1) / pfa->huge_frames;
 
-		mmap = mmap->next;
+		for (uint32_t i = 0; i < runs; i++)
+			pfa->huge_free[i] = 0;
 	}
 
-	/* Mark unavailable frames at the end of the map (padding) as used */
-	uint32_t count = pfa->bitmap_size * 8 - pfa->frame_count;
-	PageFrameAllocator_mark_range_used (pfa, pfa->frame_count, count);
+	/* Free the frames that lie entirely in free memory map entries. The
+	 * padding at the end of the bitmap stays used. With the buddy backend,
+	 * this seeds the free lists, too. */
+
+	for (uint32_t i = 0; i < pfa->mmap->count; i++)
+	{
+		SystemMemoryMap_entry *entry = &pfa->mmap->entries[i];
+
+		if (entry->type != SYSTEM_MEMORY_MAP_ENTRY_FREE)
+			continue;
+
+		uint64_t first_frame = (entry->start + pfa->frame_size - 1) / pfa->frame_size;
+		uint64_t end_frame = (entry->start + entry->size) / pfa->frame_size;
+
+		end_frame = MIN (end_frame, pfa->frame_count);
+
+		if (first_frame < end_frame)
+		{
+			PageFrameAllocator_mark_range_free (
+					pfa, first_frame, end_frame - first_frame);
+		}
+	}
 }
 
-void PageFrameAllocator_mark_used (PageFrameAllocator *pfa, uint32_t frame)
+/* Function:   PageFrameAllocator_zone_of
+ * Purpose:    to determine the zone a frame belongs to
+ * Parameters: pfa:   The page frame allocator
+ *             frame: The frame's number
+ * Returns:    The zone or NULL if the frame is not part of any zone */
+static PageFrameAllocator_zone *PageFrameAllocator_zone_of (
+		PageFrameAllocator *pfa, uint32_t frame)
+{
+	if (frame < pfa->zones[PAGE_FRAME_ALLOCATOR_ZONE_NORMAL].first_frame)
+		return &pfa->zones[PAGE_FRAME_ALLOCATOR_ZONE_DMA];
+
+	if (frame < pfa->zones[PAGE_FRAME_ALLOCATOR_ZONE_HIGH].first_frame)
+		return &pfa->zones[PAGE_FRAME_ALLOCATOR_ZONE_NORMAL];
+
+	if (frame < pfa->zones[PAGE_FRAME_ALLOCATOR_ZONE_HIGH].end_frame)
+		return &pfa->zones[PAGE_FRAME_ALLOCATOR_ZONE_HIGH];
+
+	return NULL;
+}
+
+/* Function:   PageFrameAllocator_bitmap_set
+ * Purpose:    to mark a frame as used in the bitmap and its summary and to
+ *             maintain the free frame counter. The buddy free lists are not
+ *             touched.
+ * Parameters: pfa:   The page frame allocator
+ *             frame: The frame's number
+ * Returns:    1 if the frame was free before, 0 otherwise. */
+static int PageFrameAllocator_bitmap_set (PageFrameAllocator *pfa, uint32_t frame)
+{
+	uint32_t *words = (uint32_t *) pfa->bitmap;
+	uint32_t word = frame / 32;
+	uint32_t bit = 1U << (frame % 32);
+
+	if (word >= pfa->bitmap_size / 4 || (words[word] & bit) != 0)
+		return 0;
+
+	words[word] |= bit;
+
+	PageFrameAllocator_zone *zone = PageFrameAllocator_zone_of (pfa, frame);
+
+	if (zone)
+		zone->free_frame_count--;
+
+	if (frame < pfa->frame_count)
+	{
+		pfa->free_frame_count--;
+
+		if (pfa->huge_free)
+			pfa->huge_free[frame / pfa->huge_frames]--;
+	}
+
+	if (words[word] == 0xffffffff)
+		pfa->summary[word / 32] |= 1U << (word % 32);
+
+	return 1;
+}
+
+/* Function:   PageFrameAllocator_bitmap_clear
+ * Purpose:    to mark a frame as free in the bitmap and its summary and to
+ *             maintain the free frame counter. The buddy free lists are not
+ *             touched.
+ * Parameters: pfa:   The page frame allocator
+ *             frame: The frame's number
+ * Returns:    1 if the frame was used before, 0 otherwise. */
+static int PageFrameAllocator_bitmap_clear (PageFrameAllocator *pfa, uint32_t frame)
+{
+	uint32_t *words = (uint32_t *) pfa->bitmap;
+	uint32_t word = frame / 32;
+	uint32_t bit = 1U << (frame % 32);
+
+	if (word >= pfa->bitmap_size / 4 || (words[word] & bit) == 0)
+		return 0;
+
+	words[word] &= ~bit;
+
+	PageFrameAllocator_zone *zone = PageFrameAllocator_zone_of (pfa, frame);
+
+	if (zone)
+		zone->free_frame_count++;
+
+	if (frame < pfa->frame_count)
+	{
+		pfa->free_frame_count++;
+
+		if (pfa->huge_free)
+			pfa->huge_free[frame / pfa->huge_frames]++;
+	}
+
+	pfa->summary[word / 32] &= ~(1U << (word % 32));
+
+	return 1;
+}
+
+/* Function:   PageFrameAllocator_bitmap_fill_words
+ * Purpose:    to mark the frames first_frame to end_frame - 1 as used or free
+ *             in the bitmap and its summary. Whole 32 bit words are written
+ *             at once, only the partial words at the edges are masked.
+ * Parameters: pfa:         The page frame allocator
+ *             first_frame: The first frame
+ *             end_frame:   One after the last frame
+ *             used:        1 to mark the frames as used, 0 to mark them free
+ * Returns:    The number of frames whose state changed */
+static uint32_t PageFrameAllocator_bitmap_fill_words (
+		PageFrameAllocator *pfa, uint32_t first_frame, uint32_t end_frame,
+		int used)
+{
+	uint32_t *words = (uint32_t *) pfa->bitmap;
+	uint32_t changed = 0;
+	uint32_t frame = first_frame;
+
+	while (frame < end_frame)
+	{
+		uint32_t word = frame / 32;
+		uint32_t shift = frame % 32;
+		uint32_t bits = MIN (32 - shift, end_frame - frame);
+		uint32_t mask = bits == 32 ? 0xffffffff : ((1U << bits) - 1) << shift;
+
+		uint32_t value = used ? words[word] | mask : words[word] & ~mask;
+		uint32_t word_changed = __builtin_popcount (value ^ words[word]);
+
+		changed += word_changed;
+		words[word] = value;
+
+		/* Huge runs consist of whole words */
+		if (pfa->huge_free && frame < pfa->frame_count)
+		{
+			if (used)
+				pfa->huge_free[frame / pfa->huge_frames] -= word_changed;
+			else
+				pfa->huge_free[frame / pfa->huge_frames] += word_changed;
+		}
+
+		if (value == 0xffffffff)
+			pfa->summary[word / 32] |= 1U << (word % 32);
+		else
+			pfa->summary[word / 32] &= ~(1U << (word % 32));
+
+		frame += bits;
+	}
+
+	return changed;
+}
+
+/* Function:   PageFrameAllocator_bitmap_fill
+ * Purpose:    to mark a range of frames as used or free in the bitmap and its
+ *             summary and to maintain the free frame counters. The range is
+ *             split at zone boundaries, each part is filled word-wise. The
+ *             buddy free lists are not touched.
+ * Parameters: pfa:         The page frame allocator
+ *             first_frame: The range's first frame
+ *             count:       The range's length in frames
+ *             used:        1 to mark the frames as used, 0 to mark them free */
+static void PageFrameAllocator_bitmap_fill (
+		PageFrameAllocator *pfa, uint32_t first_frame, uint32_t count, int used)
 {
-	uint32_t byte = frame / 8;
-	uint8_t bit = frame % 8;
+	uint32_t end = MIN (first_frame + count, pfa->bitmap_size * 8);
 
-	if (byte < pfa->bitmap_size)
+	while (first_frame < end)
 	{
-		pfa->bitmap[byte] |= (1 << bit);
+		PageFrameAllocator_zone *zone = PageFrameAllocator_zone_of (pfa, first_frame);
+		uint32_t limit = end;
+
+		if (zone && zone->end_frame < limit)
+			limit = zone->end_frame;
+
+		if (first_frame < pfa->frame_count && pfa->frame_count < limit)
+			limit = pfa->frame_count;
+
+		uint32_t changed = PageFrameAllocator_bitmap_fill_words (
+				pfa, first_frame, limit, used);
+
+		if (first_frame < pfa->frame_count)
+		{
+			if (used)
+				pfa->free_frame_count -= changed;
+			else
+				pfa->free_frame_count += changed;
+		}
+
+		if (zone)
+		{
+			if (used)
+				zone->free_frame_count -= changed;
+			else
+				zone->free_frame_count += changed;
+		}
+
+		first_frame = limit;
+	}
+}
+
+void PageFrameAllocator_mark_used (PageFrameAllocator *pfa, uint32_t frame)
+{
+	if (PageFrameAllocator_bitmap_set (pfa, frame) &&
+			pfa->backend == PAGE_FRAME_ALLOCATOR_BUDDY &&
+			frame < pfa->frame_count)
+	{
+		PageFrameAllocator_buddy_carve (pfa, frame);
 	}
 }
 
 void PageFrameAllocator_mark_range_used
 	(PageFrameAllocator *pfa, uint32_t first_frame, uint32_t count)
 {
-	uint32_t frame = first_frame;
+	if (pfa->backend == PAGE_FRAME_ALLOCATOR_BUDDY)
+		PageFrameAllocator_buddy_carve_range (pfa, first_frame, count);
 
-	while (frame < first_frame + count)
-		PageFrameAllocator_mark_used (pfa, frame++);
+	PageFrameAllocator_bitmap_fill (pfa, first_frame, count, 1);
 }
 
 void PageFrameAllocator_mark_free (PageFrameAllocator *pfa, uint32_t frame)
 {
-	uint32_t byte = frame / 8;
-	uint8_t bit = frame % 8;
-
-	if (byte < pfa->bitmap_size)
+	if (PageFrameAllocator_bitmap_clear (pfa, frame) &&
+			pfa->backend == PAGE_FRAME_ALLOCATOR_BUDDY &&
+			frame < pfa->frame_count)
 	{
-		pfa->bitmap[byte] &= ~(1 << bit);
+		PageFrameAllocator_buddy_release (pfa, frame, 0);
 	}
 }
 
 void PageFrameAllocator_mark_range_free
 	(PageFrameAllocator *pfa, uint32_t first_frame, uint32_t count)
 {
+	if (pfa->backend != PAGE_FRAME_ALLOCATOR_BUDDY)
+	{
+		PageFrameAllocator_bitmap_fill (pfa, first_frame, count, 0);
+		return;
+	}
+
+	/* Only the runs of frames that are used now may be released to the buddy
+	 * free lists, the free ones are on the lists already. */
 	uint32_t frame = first_frame;
+	uint32_t end = MIN (first_frame + count, pfa->frame_count);
+
+	while (frame < end)
+	{
+		uint32_t used = PageFrameAllocator_find_used (pfa, frame, end - frame);
+
+		if (used == PAGE_FRAME_ALLOCATOR_NO_FRAME)
+			break;
 
-	while (frame < first_frame + count)
-		PageFrameAllocator_mark_free (pfa, frame++);
+		frame = PageFrameAllocator_find_free (
+				pfa, used / 32, (end + 31) / 32, (1U << (used % 32)) - 1);
+
+		if (frame > end)
+			frame = end;
+
+		PageFrameAllocator_bitmap_fill (pfa, used, frame - used, 0);
+		PageFrameAllocator_buddy_release_range (pfa, used, frame - used);
+	}
 }
 
 int PageFrameAllocator_check_frames_available (
 		PageFrameAllocator *pfa, unsigned int count)
 {
-	for (uint32_t i = 0; i < pfa->frame_count && count > 0; i++)
+	return pfa->free_frame_count >= count ? 1 : 0;
+}
+
+/* Function:   PageFrameAllocator_find_free
+ * Purpose:    to find the first free frame in a range of 32 bit bitmap words.
+ *             The summary is consulted first, so that 32 fully used words are
+ *             skipped with a single compare. The free word and the free bit
+ *             inside it are located with a bit scan (bsf).
+ * Parameters: pfa:        The page frame allocator
+ *             first_word: Index of the first word to examine
+ *             last_word:  Index one after the last word to examine
+ *             mask:       Bits to treat as used in the first word, e.g. the
+ *                         frames below the search hint.
+ * Returns:    The frame number or PAGE_FRAME_ALLOCATOR_NO_FRAME if all frames
+ *             in the range are used. */
+static uint32_t PageFrameAllocator_find_free (
+		PageFrameAllocator *pfa, uint32_t first_word, uint32_t last_word,
+		uint32_t mask)
+{
+	const uint32_t *words = (const uint32_t *) pfa->bitmap;
+	uint32_t w = first_word;
+
+	while (w < last_word)
+	{
+		pfa->stats.scanned_words++;
+
+		/* Words below w count as full */
+		uint32_t full = pfa->summary[w / 32] | ((1U << (w % 32)) - 1);
+
+		if (full == 0xffffffff)
+		{
+			w = (w / 32 + 1) * 32;
+			continue;
+		}
+
+		w = (w / 32) * 32 + __builtin_ctz (~full);
+
+		if (w >= last_word)
+			break;
+
+		uint32_t used = words[w];
+
+		if (w == first_word)
+			used |= mask;
+
+		if (used != 0xffffffff)
+		{
+			uint32_t frame = w * 32 + __builtin_ctz (~used);
+
+			if (frame < pfa->frame_count)
+				return frame;
+		}
+
+		w++;
+	}
+
+	return PAGE_FRAME_ALLOCATOR_NO_FRAME;
+}
+
+/* Function:   PageFrameAllocator_zone_find_free
+ * Purpose:    to find a free frame in a zone. The search starts at the zone's
+ *             hint and wraps around to the zone's beginning once.
+ * Parameters: pfa:  The page frame allocator
+ *             zone: The zone to search
+ * Returns:    The frame number or PAGE_FRAME_ALLOCATOR_NO_FRAME if all frames
+ *             of the zone are used. */
+static uint32_t PageFrameAllocator_zone_find_free (
+		PageFrameAllocator *pfa, PageFrameAllocator_zone *zone)
+{
+	if (pfa->huge_free)
+		return PageFrameAllocator_zone_find_free_packed (pfa, zone);
+
+	uint32_t last_word = (zone->end_frame + 31) / 32;
+	uint32_t hint = zone->next_free_hint;
+
+	if (hint < zone->first_frame || hint >= zone->end_frame)
+		hint = zone->first_frame;
+
+	/* Search from the hint to the end, then wrap around to the beginning. The
+	 * word containing the hint is examined again in full on the second pass
+	 * to catch frames below the hint that were freed in the meantime. */
+	uint32_t frame = PageFrameAllocator_find_free (
+			pfa, hint / 32, last_word, (1U << (hint % 32)) - 1);
+
+	if (frame == PAGE_FRAME_ALLOCATOR_NO_FRAME)
+	{
+		frame = PageFrameAllocator_find_free (
+				pfa, zone->first_frame / 32, hint / 32 + 1, 0);
+	}
+
+	return frame;
+}
+
+/* Function:   PageFrameAllocator_zone_find_free_packed
+ * Purpose:    to find a free frame in a zone like
+ *             PageFrameAllocator_zone_find_free, but keeping free huge runs
+ *             intact. The search stays in the hint's run while it has free
+ *             frames. Otherwise it moves on to the next partially used run,
+ *             and only if there is none to the next entirely free one.
+ * Parameters: pfa:  The page frame allocator, with huge_free set
+ *             zone: The zone to search
+ * Returns:    The frame number or PAGE_FRAME_ALLOCATOR_NO_FRAME */
+static uint32_t PageFrameAllocator_zone_find_free_packed (
+		PageFrameAllocator *pfa, PageFrameAllocator_zone *zone)
+{
+	uint32_t huge = pfa->huge_frames;
+	uint32_t first_run = zone->first_frame / huge;
+	uint32_t run_count = (zone->end_frame + huge - 1) / huge - first_run;
+	uint32_t hint = zone->next_free_hint;
+
+	if (hint < zone->first_frame || hint >= zone->end_frame)
+		hint = zone->first_frame;
+
+	uint32_t run = hint / huge;
+
+	if (pfa->huge_free[run] == 0 || pfa->huge_free[run] == huge)
+	{
+		uint32_t free_run = PAGE_FRAME_ALLOCATOR_NO_FRAME;
+		uint32_t partial_run = PAGE_FRAME_ALLOCATOR_NO_FRAME;
+
+		for (uint32_t i = 0; i < run_count; i++)
+		{
+			uint32_t candidate = first_run + (run - first_run + i) % run_count;
+			uint32_t free = pfa->huge_free[candidate];
+
+			pfa->stats.scanned_words++;
+
+			if (free == 0)
+				continue;
+
+			if (free < huge)
+			{
+				partial_run = candidate;
+				break;
+			}
+
+			if (free_run == PAGE_FRAME_ALLOCATOR_NO_FRAME)
+				free_run = candidate;
+		}
+
+		if (partial_run != PAGE_FRAME_ALLOCATOR_NO_FRAME)
+			run = partial_run;
+		else if (free_run != PAGE_FRAME_ALLOCATOR_NO_FRAME)
+			run = free_run;
+		else
+			return PAGE_FRAME_ALLOCATOR_NO_FRAME;
+
+		if (run != hint / huge)
+			hint = run * huge;
+	}
+
+	/* Search the run from the hint to its end, then from its beginning */
+	uint32_t end_frame = MIN ((run + 1) * huge, zone->end_frame);
+
+	uint32_t frame = PageFrameAllocator_find_free (
+			pfa, hint / 32, (end_frame + 31) / 32, (1U << (hint % 32)) - 1);
+
+	if (frame == PAGE_FRAME_ALLOCATOR_NO_FRAME)
+	{
+		frame = PageFrameAllocator_find_free (
+				pfa, run * huge / 32, hint / 32 + 1, 0);
+	}
+
+	return frame;
+}
+
+uint64_t PageFrameAllocator_allocate (PageFrameAllocator *pfa)
+{
+	return PageFrameAllocator_allocate_flags (pfa, 0);
+}
+
+uint64_t PageFrameAllocator_allocate_flags (PageFrameAllocator *pfa, uint32_t flags)
+{
+	uint32_t scan_start = pfa->stats.scanned_words;
+	uint64_t address = 0;
+
+	if (flags & PAGE_FRAME_ALLOCATOR_ZERO)
+		address = PageFrameAllocator_zero_pool_take (pfa, flags);
+
+	if (!address)
+	{
+		uint32_t frame = PageFrameAllocator_allocate_frame (pfa, flags);
+
+		if (frame != PAGE_FRAME_ALLOCATOR_NO_FRAME)
+		{
+			address = (uint64_t) frame * 0x1000;
+
+			if (flags & PAGE_FRAME_ALLOCATOR_ZERO)
+				PageFrameAllocator_zero (pfa, address, 1);
+		}
+		else
+		{
+			/* Rather hand out a pre-zeroed frame than none at all */
+			address = PageFrameAllocator_zero_pool_take (pfa, flags);
+		}
+	}
+
+	if (address)
+		PageFrameAllocator_pages_allocated (pfa, address / 0x1000, 1);
+
+	PageFrameAllocator_account (pfa, address ? 1 : 0, scan_start);
+	return address;
+}
+
+/* Function:   PageFrameAllocator_allocate_frame
+ * Purpose:    to allocate a single frame from the zones selected by flags,
+ *             without considering the pool of pre-zeroed frames and without
+ *             zeroing the frame.
+ * Parameters: pfa:   The page frame allocator
+ *             flags: Allocation flags
+ * Returns:    The frame number or PAGE_FRAME_ALLOCATOR_NO_FRAME */
+static uint32_t PageFrameAllocator_allocate_frame (
+		PageFrameAllocator *pfa, uint32_t flags)
+{
+	const uint8_t *zone_index = PageFrameAllocator_fallback[
+		PAGE_FRAME_ALLOCATOR_PREFERRED_ZONE (flags)];
+
+	for (; *zone_index != PAGE_FRAME_ALLOCATOR_ZONE_COUNT; zone_index++)
+	{
+		PageFrameAllocator_zone *zone = &pfa->zones[*zone_index];
+		uint32_t frame;
+
+		if (zone->free_frame_count == 0)
+			continue;
+
+		if (pfa->backend == PAGE_FRAME_ALLOCATOR_BUDDY)
+			frame = PageFrameAllocator_buddy_take (pfa, zone, 0);
+		else
+			frame = PageFrameAllocator_zone_find_free (pfa, zone);
+
+		if (frame != PAGE_FRAME_ALLOCATOR_NO_FRAME)
+		{
+			PageFrameAllocator_bitmap_set (pfa, frame);
+			zone->next_free_hint = frame + 1;
+
+			return frame;
+		}
+	}
+
+	return PAGE_FRAME_ALLOCATOR_NO_FRAME;
+}
+
+uint32_t PageFrameAllocator_allocate_batch (
+		PageFrameAllocator *pfa, uint64_t *addresses, uint32_t count,
+		uint32_t flags)
+{
+	const uint32_t *words = (const uint32_t *) pfa->bitmap;
+	const uint8_t *zone_index = PageFrameAllocator_fallback[
+		PAGE_FRAME_ALLOCATOR_PREFERRED_ZONE (flags)];
+	uint32_t scan_start = pfa->stats.scanned_words;
+	uint32_t allocated = 0;
+
+	for (; *zone_index != PAGE_FRAME_ALLOCATOR_ZONE_COUNT; zone_index++)
+	{
+		PageFrameAllocator_zone *zone = &pfa->zones[*zone_index];
+
+		while (allocated < count && zone->free_frame_count > 0)
+		{
+			uint32_t frame;
+
+			if (pfa->backend == PAGE_FRAME_ALLOCATOR_BUDDY)
+			{
+				frame = PageFrameAllocator_buddy_take (pfa, zone, 0);
+
+				if (frame == PAGE_FRAME_ALLOCATOR_NO_FRAME)
+					break;
+
+				PageFrameAllocator_bitmap_set (pfa, frame);
+				addresses[allocated++] = (uint64_t) frame * 0x1000;
+				continue;
+			}
+
+			frame = PageFrameAllocator_zone_find_free (pfa, zone);
+
+			if (frame == PAGE_FRAME_ALLOCATOR_NO_FRAME)
+				break;
+
+			/* Take all free frames of the word found by a single search */
+			uint32_t word = frame / 32;
+			uint32_t free = ~words[word] & (0xffffffff << (frame % 32));
+
+			while (free && allocated < count)
+			{
+				frame = word * 32 + __builtin_ctz (free);
+				free &= free - 1;
+
+				if (frame >= zone->end_frame)
+					break;
+
+				PageFrameAllocator_bitmap_set (pfa, frame);
+				addresses[allocated++] = (uint64_t) frame * 0x1000;
+			}
+
+			zone->next_free_hint = frame + 1;
+		}
+	}
+
+	if (flags & PAGE_FRAME_ALLOCATOR_ZERO)
+	{
+		for (uint32_t i = 0; i < allocated; i++)
+			PageFrameAllocator_zero (pfa, addresses[i], 1);
+	}
+
+	if (pfa->pages)
 	{
-		if ((pfa->bitmap[i / 8] & (1 << (i % 8))) == 0)
-			count--;
+		for (uint32_t i = 0; i < allocated; i++)
+			PageFrameAllocator_pages_allocated (pfa, addresses[i] / 0x1000, 1);
 	}
 
-	return count == 0 ? 1 : 0;
+	PageFrameAllocator_account (pfa, allocated, scan_start);
+	return allocated;
 }
 
-uint32_t PageFrameAllocator_allocate (PageFrameAllocator *pfa)
+/* Function:   PageFrameAllocator_find_used
+ * Purpose:    to find the first used frame in a range of frames. The bitmap
+ *             is examined one 32 bit word at a time.
+ * Parameters: pfa:         The page frame allocator
+ *             first_frame: The first frame of the range
+ *             count:       The number of frames in the range
+ * Returns:    The frame number or PAGE_FRAME_ALLOCATOR_NO_FRAME if all frames
+ *             in the range are free. */
+static uint32_t PageFrameAllocator_find_used (
+		PageFrameAllocator *pfa, uint32_t first_frame, uint32_t count)
 {
-	for (uint32_t i = 0; i < pfa->frame_count; i++)
+	const uint32_t *words = (const uint32_t *) pfa->bitmap;
+	uint32_t frame = first_frame;
+	uint32_t end = first_frame + count;
+
+	while (frame < end)
 	{
-		if ((pfa->bitmap[i / 8] & (1 << (i % 8))) == 0)
+		uint32_t used = words[frame / 32] >> (frame % 32);
+		uint32_t bits = 32 - frame % 32;
+
+		if (bits > end - frame)
 		{
-			PageFrameAllocator_mark_used (pfa, i);
-			return i * 0x1000;
+			bits = end - frame;
+			used &= (1U << bits) - 1;
 		}
+
+		if (used)
+			return frame + __builtin_ctz (used);
+
+		frame += bits;
+	}
+
+	return PAGE_FRAME_ALLOCATOR_NO_FRAME;
+}
+
+/* Function:   PageFrameAllocator_zone_allocate_range
+ * Purpose:    to allocate a run of contiguous, aligned frames from a zone
+ * Parameters: pfa:       The page frame allocator
+ *             zone:      The zone to allocate from
+ *             count:     The run's length in frames
+ *             alignment: The first frame's alignment in frames (power of 2)
+ * Returns:    The run's first frame or PAGE_FRAME_ALLOCATOR_NO_FRAME. */
+static uint32_t PageFrameAllocator_zone_allocate_range (
+		PageFrameAllocator *pfa, PageFrameAllocator_zone *zone,
+		uint32_t count, uint32_t alignment)
+{
+	/* The buddy backend serves the run from the smallest block that is big
+	 * and aligned enough and returns the tail. Runs bigger than the biggest
+	 * block are searched in the bitmap, mark_range_used then carves them out
+	 * of the free lists. */
+	if (pfa->backend == PAGE_FRAME_ALLOCATOR_BUDDY)
+	{
+		uint8_t order = 0;
+
+		while ((1U << order) < count || (1U << order) < alignment)
+			order++;
+
+		if (order <= PAGE_FRAME_ALLOCATOR_BUDDY_MAX_ORDER)
+		{
+			uint32_t frame = PageFrameAllocator_buddy_take (pfa, zone, order);
+
+			if (frame == PAGE_FRAME_ALLOCATOR_NO_FRAME)
+				return PAGE_FRAME_ALLOCATOR_NO_FRAME;
+
+			PageFrameAllocator_bitmap_fill (pfa, frame, count, 1);
+
+			PageFrameAllocator_buddy_release_range (
+					pfa, frame + count, (1U << order) - count);
+
+			return frame;
+		}
+	}
+
+	/* First fit: start at the first free frame and, whenever the candidate
+	 * run contains a used frame, continue at the next free frame after it. */
+	uint32_t last_word = (zone->end_frame + 31) / 32;
+	uint32_t candidate = PageFrameAllocator_find_free (
+			pfa, zone->first_frame / 32, last_word, 0);
+
+	while (candidate != PAGE_FRAME_ALLOCATOR_NO_FRAME)
+	{
+		candidate = (candidate + alignment - 1) & ~(alignment - 1);
+
+		if (candidate >= zone->end_frame || zone->end_frame - candidate < count)
+			break;
+
+		uint32_t used = PageFrameAllocator_find_used (pfa, candidate, count);
+
+		if (used == PAGE_FRAME_ALLOCATOR_NO_FRAME)
+		{
+			PageFrameAllocator_mark_range_used (pfa, candidate, count);
+			return candidate;
+		}
+
+		used++;
+		candidate = PageFrameAllocator_find_free (
+				pfa, used / 32, last_word, (1U << (used % 32)) - 1);
+	}
+
+	return PAGE_FRAME_ALLOCATOR_NO_FRAME;
+}
+
+uint64_t PageFrameAllocator_allocate_range (
+		PageFrameAllocator *pfa, uint32_t count, uint32_t alignment)
+{
+	return PageFrameAllocator_allocate_range_flags (pfa, count, alignment, 0);
+}
+
+uint64_t PageFrameAllocator_allocate_range_flags (
+		PageFrameAllocator *pfa, uint32_t count, uint32_t alignment,
+		uint32_t flags)
+{
+	const uint8_t *zone_index = PageFrameAllocator_fallback[
+		PAGE_FRAME_ALLOCATOR_PREFERRED_ZONE (flags)];
+	uint32_t scan_start = pfa->stats.scanned_words;
+	uint32_t frame = PAGE_FRAME_ALLOCATOR_NO_FRAME;
+
+	if (alignment == 0)
+		alignment = 1;
+
+	if (count > 0 && count <= pfa->free_frame_count)
+	{
+		for (; frame == PAGE_FRAME_ALLOCATOR_NO_FRAME &&
+				*zone_index != PAGE_FRAME_ALLOCATOR_ZONE_COUNT; zone_index++)
+		{
+			PageFrameAllocator_zone *zone = &pfa->zones[*zone_index];
+
+			if (zone->free_frame_count < count)
+				continue;
+
+			frame = PageFrameAllocator_zone_allocate_range (
+					pfa, zone, count, alignment);
+		}
+	}
+
+	if (frame == PAGE_FRAME_ALLOCATOR_NO_FRAME)
+	{
+		PageFrameAllocator_account (pfa, 0, scan_start);
+		return 0;
+	}
+
+	PageFrameAllocator_pages_allocated (pfa, frame, count);
+	PageFrameAllocator_account (pfa, count, scan_start);
+
+	if (flags & PAGE_FRAME_ALLOCATOR_ZERO)
+		PageFrameAllocator_zero (pfa, (uint64_t) frame * 0x1000, count);
+
+	return (uint64_t) frame * 0x1000;
+}
+
+uint64_t PageFrameAllocator_allocate_huge (
+		PageFrameAllocator *pfa, uint32_t flags)
+{
+	uint32_t huge = pfa->huge_frames;
+
+	if (pfa->backend == PAGE_FRAME_ALLOCATOR_BUDDY || !pfa->huge_free)
+		return PageFrameAllocator_allocate_range_flags (pfa, huge, huge, flags);
+
+	/* Look for an entirely free run in the counters rather than the bitmap */
+	const uint8_t *zone_index = PageFrameAllocator_fallback[
+		PAGE_FRAME_ALLOCATOR_PREFERRED_ZONE (flags)];
+	uint32_t scan_start = pfa->stats.scanned_words;
+	uint32_t frame = PAGE_FRAME_ALLOCATOR_NO_FRAME;
+
+	for (; frame == PAGE_FRAME_ALLOCATOR_NO_FRAME &&
+			*zone_index != PAGE_FRAME_ALLOCATOR_ZONE_COUNT; zone_index++)
+	{
+		PageFrameAllocator_zone *zone = &pfa->zones[*zone_index];
+
+		if (zone->free_frame_count < huge)
+			continue;
+
+		for (uint32_t run = zone->first_frame / huge; run < zone->end_frame / huge; run++)
+		{
+			pfa->stats.scanned_words++;
+
+			if (pfa->huge_free[run] == huge)
+			{
+				frame = run * huge;
+				break;
+			}
+		}
+	}
+
+	if (frame == PAGE_FRAME_ALLOCATOR_NO_FRAME)
+	{
+		PageFrameAllocator_account (pfa, 0, scan_start);
+		return 0;
+	}
+
+	PageFrameAllocator_mark_range_used (pfa, frame, huge);
+	PageFrameAllocator_pages_allocated (pfa, frame, huge);
+	PageFrameAllocator_account (pfa, huge, scan_start);
+
+	if (flags & PAGE_FRAME_ALLOCATOR_ZERO)
+		PageFrameAllocator_zero (pfa, (uint64_t) frame * 0x1000, huge);
+
+	return (uint64_t) frame * 0x1000;
+}
+
+void PageFrameAllocator_free_range (
+		PageFrameAllocator *pfa, uint64_t address, uint32_t count)
+{
+	PageFrameAllocator_pages_freed (pfa, address / 0x1000, count);
+	PageFrameAllocator_mark_range_free (pfa, address / 0x1000, count);
+	pfa->stats.freed_frames += count;
+}
+
+void PageFrameAllocator_free_batch (
+		PageFrameAllocator *pfa, const uint64_t *addresses, uint32_t count)
+{
+	uint32_t i = 0;
+
+	while (i < count)
+	{
+		uint32_t run = 1;
+
+		while (i + run < count &&
+				addresses[i + run] == addresses[i] + (uint64_t) run * 0x1000)
+		{
+			run++;
+		}
+
+		PageFrameAllocator_pages_freed (pfa, addresses[i] / 0x1000, run);
+		PageFrameAllocator_mark_range_free (pfa, addresses[i] / 0x1000, run);
+		i += run;
+	}
+
+	pfa->stats.freed_frames += count;
+}
+
+
+/********************************* Statistics *********************************
+ *
+ * Counters for allocation requests and the free run histogram, which shows
+ * how fragmented the free memory is.
+ *
+ *****************************************************************************/
+
+/* Function:   PageFrameAllocator_account
+ * Purpose:    to account an allocation request
+ * Parameters: pfa:        The page frame allocator
+ *             frames:     The number of frames allocated, 0 if the request
+ *                         failed
+ *             scan_start: stats.scanned_words before the request */
+static void PageFrameAllocator_account (
+		PageFrameAllocator *pfa, uint32_t frames, uint32_t scan_start)
+{
+	uint32_t scanned = pfa->stats.scanned_words - scan_start;
+
+	pfa->stats.allocations++;
+
+	if (frames)
+		pfa->stats.allocated_frames += frames;
+	else
+		pfa->stats.failures++;
+
+	if (scanned > pfa->stats.max_scanned_words)
+		pfa->stats.max_scanned_words = scanned;
+}
+
+uint32_t PageFrameAllocator_free_run_histogram (
+		PageFrameAllocator *pfa,
+		uint32_t histogram[PAGE_FRAME_ALLOCATOR_HISTOGRAM_BUCKETS])
+{
+	const uint32_t *words = (const uint32_t *) pfa->bitmap;
+	uint32_t longest = 0;
+	uint32_t run = 0;
+
+	for (int i = 0; i < PAGE_FRAME_ALLOCATOR_HISTOGRAM_BUCKETS; i++)
+		histogram[i] = 0;
+
+	/* One more iteration than there are frames ends the last run */
+	for (uint32_t frame = 0; frame <= pfa->frame_count; frame++)
+	{
+		/* Skip entirely free words */
+		if (frame % 32 == 0 && frame + 32 <= pfa->frame_count &&
+				words[frame / 32] == 0)
+		{
+			run += 32;
+			frame += 31;
+			continue;
+		}
+
+		if (frame < pfa->frame_count && !(words[frame / 32] & (1U << (frame % 32))))
+		{
+			run++;
+			continue;
+		}
+
+		if (run > 0)
+		{
+			int bucket = MIN (31 - __builtin_clz (run),
+					PAGE_FRAME_ALLOCATOR_HISTOGRAM_BUCKETS - 1);
+
+			histogram[bucket]++;
+			longest = MAX (longest, run);
+			run = 0;
+		}
+	}
+
+	return longest;
+}
+
+void PageFrameAllocator_dump_stats (
+		PageFrameAllocator *pfa, int machine_readable)
+{
+	PageFrameAllocator_stats *stats = &pfa->stats;
+	uint32_t histogram[PAGE_FRAME_ALLOCATOR_HISTOGRAM_BUCKETS];
+	uint32_t longest = PageFrameAllocator_free_run_histogram (pfa, histogram);
+
+	printf ("PFA: %d of %d frames free (DMA: %d, normal: %d, high: %d)\n",
+			(int) pfa->free_frame_count,
+			(int) pfa->frame_count,
+			(int) pfa->zones[PAGE_FRAME_ALLOCATOR_ZONE_DMA].free_frame_count,
+			(int) pfa->zones[PAGE_FRAME_ALLOCATOR_ZONE_NORMAL].free_frame_count,
+			(int) pfa->zones[PAGE_FRAME_ALLOCATOR_ZONE_HIGH].free_frame_count);
+
+	printf ("PFA: %d allocations (%d failed), %d frames allocated, %d freed\n",
+			(int) stats->allocations,
+			(int) stats->failures,
+			(int) stats->allocated_frames,
+			(int) stats->freed_frames);
+
+	printf ("PFA: %d zero pool hits, %d words scanned, at most %d per request\n",
+			(int) stats->zero_pool_hits,
+			(int) stats->scanned_words,
+			(int) stats->max_scanned_words);
+
+	printf ("PFA: free runs:");
+
+	for (int i = 0; i < PAGE_FRAME_ALLOCATOR_HISTOGRAM_BUCKETS; i++)
+		printf (" %d:%d", 1 << i, (int) histogram[i]);
+
+	printf (", longest: %d\n", (int) longest);
+
+	if (!machine_readable)
+		return;
+
+	/* A single line, printed piecewise as it exceeds printf's buffer */
+	printf ("PFA_STATS frames=%d free=%d dma=%d normal=%d high=%d",
+			(int) pfa->frame_count,
+			(int) pfa->free_frame_count,
+			(int) pfa->zones[PAGE_FRAME_ALLOCATOR_ZONE_DMA].free_frame_count,
+			(int) pfa->zones[PAGE_FRAME_ALLOCATOR_ZONE_NORMAL].free_frame_count,
+			(int) pfa->zones[PAGE_FRAME_ALLOCATOR_ZONE_HIGH].free_frame_count);
+
+	printf (" allocations=%d failures=%d allocated=%d freed=%d",
+			(int) stats->allocations,
+			(int) stats->failures,
+			(int) stats->allocated_frames,
+			(int) stats->freed_frames);
+
+	printf (" zero_pool_hits=%d scanned=%d max_scanned=%d longest_run=%d runs=",
+			(int) stats->zero_pool_hits,
+			(int) stats->scanned_words,
+			(int) stats->max_scanned_words,
+			(int) longest);
+
+	for (int i = 0; i < PAGE_FRAME_ALLOCATOR_HISTOGRAM_BUCKETS; i++)
+		printf (i ? ",%d" : "%d", (int) histogram[i]);
+
+	printf ("\n");
+}
+
+
+/****************************** Frame descriptors *****************************
+ *
+ * One PageFrameAllocator_page per frame, if pages is set. Descriptors are
+ * kept small, so that those of neighbouring frames share cache lines.
+ *
+ *****************************************************************************/
+
+void PageFrameAllocator_set_owner (
+		PageFrameAllocator *pfa, uint64_t address, uint32_t count,
+		enum PageFrameAllocator_owner owner, void *private)
+{
+	PageFrameAllocator_page *page = PageFrameAllocator_page_of (pfa, address);
+
+	if (!page)
+		return;
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		page[i].owner = owner;
+		page[i].private = private;
+	}
+}
+
+void PageFrameAllocator_get_page (PageFrameAllocator *pfa, uint64_t address)
+{
+	PageFrameAllocator_page *page = PageFrameAllocator_page_of (pfa, address);
+
+	/* Frames that are free or marked used can't be shared */
+	if (!page || page->refcount == 0)
+	{
+		printf ("PFA: get_page of unallocated frame 0x%llx\n",
+				(long long) address);
+		return;
+	}
+
+	page->refcount++;
+}
+
+uint32_t PageFrameAllocator_put_page (PageFrameAllocator *pfa, uint64_t address)
+{
+	PageFrameAllocator_page *page = PageFrameAllocator_page_of (pfa, address);
+
+	/* Catch double frees rather than wrapping the reference count */
+	if (!page || page->refcount == 0)
+	{
+		printf ("PFA: put_page of unallocated frame 0x%llx\n",
+				(long long) address);
+		return 0;
+	}
+
+	uint32_t refcount = --page->refcount;
+
+	if (refcount == 0)
+		PageFrameAllocator_free_range (pfa, address, 1);
+
+	return refcount;
+}
+
+/* Function:   PageFrameAllocator_pages_allocated
+ * Purpose:    to set the descriptors of frames that were just allocated to
+ *             one reference and no owner, if there are descriptors
+ * Parameters: pfa:         The page frame allocator
+ *             first_frame: The first frame's number
+ *             count:       The number of frames */
+static inline void PageFrameAllocator_pages_allocated (
+		PageFrameAllocator *pfa, uint32_t first_frame, uint32_t count)
+{
+	if (!pfa->pages)
+		return;
+
+	PageFrameAllocator_page *page = &pfa->pages[first_frame];
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		page[i].private = NULL;
+		page[i].refcount = 1;
+		page[i].flags = PAGE_FRAME_ALLOCATOR_PAGE_ALLOCATED;
+		page[i].owner = PAGE_FRAME_ALLOCATOR_OWNER_NONE;
+	}
+}
+
+/* Function:   PageFrameAllocator_pages_freed
+ * Purpose:    to reset the descriptors of frames that are freed, if there
+ *             are descriptors
+ * Parameters: pfa:         The page frame allocator
+ *             first_frame: The first frame's number
+ *             count:       The number of frames */
+static inline void PageFrameAllocator_pages_freed (
+		PageFrameAllocator *pfa, uint32_t first_frame, uint32_t count)
+{
+	if (!pfa->pages)
+		return;
+
+	PageFrameAllocator_page *page = &pfa->pages[first_frame];
+
+	for (uint32_t i = 0; i < count && first_frame + i < pfa->frame_count; i++)
+	{
+		page[i].private = NULL;
+		page[i].refcount = 0;
+		page[i].flags = 0;
+		page[i].owner = PAGE_FRAME_ALLOCATOR_OWNER_NONE;
+	}
+}
+
+
+/****************************** Pre-zeroed frames *****************************
+ *
+ * A small pool of allocated frames that were zeroed in advance, e.g. while
+ * the CPU was idle. Frames are zeroed through pfa->zero_frame, which may use
+ * non-temporal stores so that zeroing does not evict useful cache lines. The
+ * pool is only refilled from the normal and DMA zones.
+ *
+ *****************************************************************************/
+
+/* Function:   PageFrameAllocator_zero
+ * Purpose:    to zero a run of frames
+ * Parameters: pfa:     The page frame allocator
+ *             address: The first frame's address
+ *             count:   The number of frames */
+static void PageFrameAllocator_zero (
+		PageFrameAllocator *pfa, uint64_t address, uint32_t count)
+{
+	if (pfa->zero_frame)
+		pfa->zero_frame (address, count * pfa->frame_size);
+	else
+		bzero ((void *) (uintptr_t) address, count * pfa->frame_size);
+}
+
+/* Function:   PageFrameAllocator_zero_pool_take
+ * Purpose:    to take a frame from the pool of pre-zeroed frames that
+ *             satisfies the zone requirement of flags.
+ * Parameters: pfa:   The page frame allocator
+ *             flags: Allocation flags
+ * Returns:    The frame's address or 0 if there is no suitable frame */
+static uint64_t PageFrameAllocator_zero_pool_take (
+		PageFrameAllocator *pfa, uint32_t flags)
+{
+	for (uint32_t i = pfa->zero_pool_count; i > 0; i--)
+	{
+		uint64_t address = pfa->zero_pool[i - 1];
+
+		if ((flags & PAGE_FRAME_ALLOCATOR_DMA) &&
+				address >= PAGE_FRAME_ALLOCATOR_DMA_LIMIT)
+		{
+			continue;
+		}
+
+		pfa->zero_pool[i - 1] = pfa->zero_pool[--pfa->zero_pool_count];
+		pfa->stats.zero_pool_hits++;
+		return address;
 	}
 
 	return 0;
 }
+
+uint32_t PageFrameAllocator_refill_zero_pool (
+		PageFrameAllocator *pfa, uint32_t max_frames)
+{
+	uint32_t added = 0;
+
+	while (added < max_frames &&
+			pfa->zero_pool_count < PAGE_FRAME_ALLOCATOR_ZERO_POOL_SIZE)
+	{
+		uint32_t frame = PageFrameAllocator_allocate_frame (pfa, 0);
+
+		if (frame == PAGE_FRAME_ALLOCATOR_NO_FRAME)
+			break;
+
+		PageFrameAllocator_zero (pfa, (uint64_t) frame * 0x1000, 1);
+		pfa->zero_pool[pfa->zero_pool_count++] = (uint64_t) frame * 0x1000;
+		added++;
+	}
+
+	return added;
+}
+
+
+/******************************** Buddy backend *******************************
+ *
+ * Free memory is kept in blocks of 2^order frames that start at a multiple
+ * of their size. Each zone has a doubly linked free list per order threaded
+ * through buddy_nodes, the node of a block's first frame records the block's
+ * order. Zone boundaries are aligned to the biggest block size, hence blocks
+ * and their buddies never span zones.
+ * The bitmap is maintained alongside, hence the bitmap based functions work
+ * with this backend, too.
+ *
+ *****************************************************************************/
+
+/* Function:   PageFrameAllocator_buddy_push
+ * Purpose:    to insert a free block at the head of its order's free list
+ * Parameters: pfa:   The page frame allocator
+ *             frame: The block's first frame
+ *             order: The block's order */
+static void PageFrameAllocator_buddy_push (
+		PageFrameAllocator *pfa, uint32_t frame, uint8_t order)
+{
+	PageFrameAllocator_buddy_node *node = &pfa->buddy_nodes[frame];
+	PageFrameAllocator_zone *zone = PageFrameAllocator_zone_of (pfa, frame);
+
+	node->order = order;
+	node->previous = PAGE_FRAME_ALLOCATOR_NO_FRAME;
+	node->next = zone->buddy_free[order];
+
+	if (node->next != PAGE_FRAME_ALLOCATOR_NO_FRAME)
+		pfa->buddy_nodes[node->next].previous = frame;
+
+	zone->buddy_free[order] = frame;
+}
+
+/* Function:   PageFrameAllocator_buddy_remove
+ * Purpose:    to unlink a free block from its order's free list
+ * Parameters: pfa:   The page frame allocator
+ *             frame: The block's first frame */
+static void PageFrameAllocator_buddy_remove (PageFrameAllocator *pfa, uint32_t frame)
+{
+	PageFrameAllocator_buddy_node *node = &pfa->buddy_nodes[frame];
+
+	if (node->previous != PAGE_FRAME_ALLOCATOR_NO_FRAME)
+		pfa->buddy_nodes[node->previous].next = node->next;
+	else
+		PageFrameAllocator_zone_of (pfa, frame)->buddy_free[node->order] = node->next;
+
+	if (node->next != PAGE_FRAME_ALLOCATOR_NO_FRAME)
+		pfa->buddy_nodes[node->next].previous = node->previous;
+
+	node->order = PAGE_FRAME_ALLOCATOR_BUDDY_NOT_FREE;
+}
+
+/* Function:   PageFrameAllocator_buddy_release
+ * Purpose:    to return a block to the free lists. As long as the block's
+ *             buddy is free as a whole, both are merged to a block of the next
+ *             higher order.
+ * Parameters: pfa:   The page frame allocator
+ *             frame: The block's first frame
+ *             order: The block's order */
+static void PageFrameAllocator_buddy_release (
+		PageFrameAllocator *pfa, uint32_t frame, uint8_t order)
+{
+	while (order < PAGE_FRAME_ALLOCATOR_BUDDY_MAX_ORDER)
+	{
+		uint32_t buddy = frame ^ (1U << order);
+
+		if (buddy >= pfa->frame_count || pfa->buddy_nodes[buddy].order != order)
+			break;
+
+		PageFrameAllocator_buddy_remove (pfa, buddy);
+		frame &= ~(1U << order);
+		order++;
+	}
+
+	PageFrameAllocator_buddy_push (pfa, frame, order);
+}
+
+/* Function:   PageFrameAllocator_buddy_release_range
+ * Purpose:    to return a run of frames that is free in the bitmap but not
+ *             part of any free list yet. The run is split into the biggest
+ *             naturally aligned blocks possible.
+ * Parameters: pfa:         The page frame allocator
+ *             first_frame: The run's first frame
+ *             count:       The run's length in frames */
+static void PageFrameAllocator_buddy_release_range (
+		PageFrameAllocator *pfa, uint32_t first_frame, uint32_t count)
+{
+	while (count > 0)
+	{
+		uint8_t order = PAGE_FRAME_ALLOCATOR_BUDDY_MAX_ORDER;
+
+		if (first_frame != 0 && __builtin_ctz (first_frame) < order)
+			order = __builtin_ctz (first_frame);
+
+		while ((1U << order) > count)
+			order--;
+
+		PageFrameAllocator_buddy_release (pfa, first_frame, order);
+
+		first_frame += 1U << order;
+		count -= 1U << order;
+	}
+}
+
+/* Function:   PageFrameAllocator_buddy_take
+ * Purpose:    to remove a block of a given order from a zone's free lists. If
+ *             no block of that order is free, a bigger one is split and the
+ *             unused halves are returned to the lower orders' lists.
+ * Parameters: pfa:   The page frame allocator
+ *             zone:  The zone to take the block from
+ *             order: The desired order
+ * Returns:    The block's first frame or PAGE_FRAME_ALLOCATOR_NO_FRAME. The
+ *             block is not marked as used in the bitmap. */
+static uint32_t PageFrameAllocator_buddy_take (
+		PageFrameAllocator *pfa, PageFrameAllocator_zone *zone, uint8_t order)
+{
+	uint8_t current = order;
+
+	while (current <= PAGE_FRAME_ALLOCATOR_BUDDY_MAX_ORDER &&
+			zone->buddy_free[current] == PAGE_FRAME_ALLOCATOR_NO_FRAME)
+	{
+		current++;
+	}
+
+	if (current > PAGE_FRAME_ALLOCATOR_BUDDY_MAX_ORDER)
+		return PAGE_FRAME_ALLOCATOR_NO_FRAME;
+
+	uint32_t frame = zone->buddy_free[current];
+	PageFrameAllocator_buddy_remove (pfa, frame);
+
+	while (current > order)
+	{
+		current--;
+		PageFrameAllocator_buddy_push (pfa, frame + (1U << current), current);
+	}
+
+	return frame;
+}
+
+/* Function:   PageFrameAllocator_buddy_carve
+ * Purpose:    to remove a single frame from the free block containing it. The
+ *             block is split down to order 0 and all other parts are put back
+ *             on the free lists.
+ * Parameters: pfa:   The page frame allocator
+ *             frame: The frame to remove */
+static void PageFrameAllocator_buddy_carve (PageFrameAllocator *pfa, uint32_t frame)
+{
+	uint8_t order;
+	uint32_t head = frame;
+
+	for (order = 0; order <= PAGE_FRAME_ALLOCATOR_BUDDY_MAX_ORDER; order++)
+	{
+		head = frame & ~((1U << order) - 1);
+
+		if (pfa->buddy_nodes[head].order == order)
+			break;
+	}
+
+	if (order > PAGE_FRAME_ALLOCATOR_BUDDY_MAX_ORDER)
+		return;
+
+	PageFrameAllocator_buddy_remove (pfa, head);
+
+	while (order > 0)
+	{
+		order--;
+
+		if (frame >= head + (1U << order))
+		{
+			PageFrameAllocator_buddy_push (pfa, head, order);
+			head += 1U << order;
+		}
+		else
+		{
+			PageFrameAllocator_buddy_push (pfa, head + (1U << order), order);
+		}
+	}
+}
+
+/* Function:   PageFrameAllocator_buddy_carve_range
+ * Purpose:    to remove a range of frames from the free lists. Every free
+ *             block that overlaps the range is taken off its list as a whole,
+ *             the parts outside of the range are released again. Used frames
+ *             are skipped word-wise. Must be called before the range is marked
+ *             as used in the bitmap.
+ * Parameters: pfa:         The page frame allocator
+ *             first_frame: The range's first frame
+ *             count:       The range's length in frames */
+static void PageFrameAllocator_buddy_carve_range (
+		PageFrameAllocator *pfa, uint32_t first_frame, uint32_t count)
+{
+	uint32_t end = MIN (first_frame + count, pfa->frame_count);
+	uint32_t frame = first_frame;
+
+	while (frame < end)
+	{
+		frame = PageFrameAllocator_find_free (
+				pfa, frame / 32, (end + 31) / 32, (1U << (frame % 32)) - 1);
+
+		if (frame >= end)
+			break;
+
+		/* Find the free block containing the frame */
+		uint8_t order;
+		uint32_t head = frame;
+
+		for (order = 0; order <= PAGE_FRAME_ALLOCATOR_BUDDY_MAX_ORDER; order++)
+		{
+			head = frame & ~((1U << order) - 1);
+
+			if (pfa->buddy_nodes[head].order == order)
+				break;
+		}
+
+		if (order > PAGE_FRAME_ALLOCATOR_BUDDY_MAX_ORDER)
+			return;
+
+		uint32_t block_end = head + (1U << order);
+
+		PageFrameAllocator_buddy_remove (pfa, head);
+
+		if (head < first_frame)
+			PageFrameAllocator_buddy_release_range (pfa, head, first_frame - head);
+
+		if (block_end > end)
+			PageFrameAllocator_buddy_release_range (pfa, end, block_end - end);
+
+		frame = block_end;
+	}
+}
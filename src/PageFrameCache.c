@@ -0,0 +1,126 @@
+#include "PageFrameCache.h"
+
+/* Static prototypes */
+static void PageFrameCache_drain_batch (
+		PageFrameCache *cache, PageFrameCache_cpu *pcpu, uint32_t count);
+
+static inline void PageFrameCache_reset_page (
+		PageFrameCache *cache, uint64_t address, uint16_t refcount);
+
+void PageFrameCache_init (PageFrameCache *cache, PageFrameAllocator *pfa,
+		PageFrameCache_cpu *cpus, unsigned int cpu_count)
+{
+	cache->pfa = pfa;
+	cache->lock = 0;
+	cache->cpu_count = cpu_count;
+	cache->cpus = cpus;
+
+	for (unsigned int i = 0; i < cpu_count; i++)
+		cpus[i].count = 0;
+}
+
+void PageFrameCache_lock (PageFrameCache *cache)
+{
+	while (__sync_lock_test_and_set (&cache->lock, 1))
+	{
+		while (cache->lock)
+			asm volatile ("pause");
+	}
+}
+
+void PageFrameCache_unlock (PageFrameCache *cache)
+{
+	__sync_lock_release (&cache->lock);
+}
+
+uint64_t PageFrameCache_allocate (PageFrameCache *cache, unsigned int cpu)
+{
+	PageFrameCache_cpu *pcpu = &cache->cpus[cpu];
+
+	if (pcpu->count == 0)
+	{
+		PageFrameCache_lock (cache);
+
+		pcpu->count = PageFrameAllocator_allocate_batch (
+				cache->pfa, pcpu->frames, PAGE_FRAME_CACHE_BATCH, 0);
+
+		PageFrameCache_unlock (cache);
+
+		if (pcpu->count == 0)
+			return 0;
+
+		/* The batch was allocated, but the frames are on the stack now */
+		for (uint32_t i = 0; i < pcpu->count; i++)
+			PageFrameCache_reset_page (cache, pcpu->frames[i], 0);
+	}
+
+	uint64_t address = pcpu->frames[--pcpu->count];
+
+	PageFrameCache_reset_page (cache, address, 1);
+
+	return address;
+}
+
+void PageFrameCache_free (PageFrameCache *cache, unsigned int cpu, uint64_t address)
+{
+	PageFrameCache_cpu *pcpu = &cache->cpus[cpu];
+
+	if (pcpu->count == PAGE_FRAME_CACHE_SIZE)
+		PageFrameCache_drain_batch (cache, pcpu, PAGE_FRAME_CACHE_BATCH);
+
+	PageFrameCache_reset_page (cache, address, 0);
+
+	pcpu->frames[pcpu->count++] = address;
+}
+
+void PageFrameCache_drain (PageFrameCache *cache, unsigned int cpu)
+{
+	PageFrameCache_cpu *pcpu = &cache->cpus[cpu];
+
+	PageFrameCache_drain_batch (cache, pcpu, pcpu->count);
+}
+
+/* Function:   PageFrameCache_drain_batch
+ * Purpose:    to return frames from the bottom of a CPU's stack, that is the
+ *             ones freed longest ago, to the allocator.
+ * Parameters: cache: The page frame cache
+ *             pcpu:  The CPU's stack
+ *             count: Number of frames to return */
+static void PageFrameCache_drain_batch (
+		PageFrameCache *cache, PageFrameCache_cpu *pcpu, uint32_t count)
+{
+	PageFrameCache_lock (cache);
+
+	PageFrameAllocator_free_batch (cache->pfa, pcpu->frames, count);
+
+	PageFrameCache_unlock (cache);
+
+	for (uint32_t i = count; i < pcpu->count; i++)
+		pcpu->frames[i - count] = pcpu->frames[i];
+
+	pcpu->count -= count;
+}
+
+/* Function:   PageFrameCache_reset_page
+ * Purpose:    to clear the owner of a frame's descriptor, if there are
+ *             descriptors, when it enters or leaves a CPU's stack. Frames on
+ *             a stack have a reference count of 0 and are not marked
+ *             allocated, which catches double frees with
+ *             PageFrameAllocator_put_page, allocated ones have 1.
+ * Parameters: cache:    The page frame cache
+ *             address:  The frame's address
+ *             refcount: The new reference count */
+static inline void PageFrameCache_reset_page (
+		PageFrameCache *cache, uint64_t address, uint16_t refcount)
+{
+	PageFrameAllocator_page *page = PageFrameAllocator_page_of (
+			cache->pfa, address);
+
+	if (!page)
+		return;
+
+	page->refcount = refcount;
+	page->flags = refcount ? PAGE_FRAME_ALLOCATOR_PAGE_ALLOCATED : 0;
+	page->owner = PAGE_FRAME_ALLOCATOR_OWNER_NONE;
+	page->private = NULL;
+}
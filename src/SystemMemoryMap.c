@@ -2,20 +2,226 @@
 #include "utils.h"
 #include "stdio.h"
 
-uint64_t SystemMemoryMap_get_memory_size (SystemMemoryMap mmap)
+/* Types in the order of their precedence, the first one wins */
+static const uint32_t SystemMemoryMap_types[] = {
+	SYSTEM_MEMORY_MAP_ENTRY_RESERVED,
+	SYSTEM_MEMORY_MAP_ENTRY_ACPI_NVS,
+	SYSTEM_MEMORY_MAP_ENTRY_ACPI_RECLAIM,
+	SYSTEM_MEMORY_MAP_ENTRY_WELL_KNOWN_PC,
+	SYSTEM_MEMORY_MAP_ENTRY_FREE
+};
+
+#define SYSTEM_MEMORY_MAP_TYPE_COUNT \
+	(sizeof (SystemMemoryMap_types) / sizeof (SystemMemoryMap_types[0]))
+
+/* Static prototypes */
+static uint32_t SystemMemoryMap_precedence (uint32_t type);
+
+static void SystemMemoryMap_sift_down (SystemMemoryMap_boundary *boundaries,
+		uint32_t root, uint32_t count);
+
+static void SystemMemoryMap_sort (SystemMemoryMap_boundary *boundaries,
+		uint32_t count);
+
+
+uint32_t SystemMemoryMap_normalize (SystemMemoryMap *mmap,
+		const SystemMemoryMap_entry *raw, uint32_t raw_count,
+		SystemMemoryMap_boundary *boundaries)
 {
-	uint64_t size = 0;
+	uint32_t boundary_count = 0;
+
+	for (uint32_t i = 0; i < raw_count; i++)
+	{
+		if (raw[i].size == 0)
+			continue;
 
-	while (mmap)
+		uint32_t precedence = SystemMemoryMap_precedence (raw[i].type);
+		uint64_t end = raw[i].start + raw[i].size;
+
+		/* Clip entries that wrap around */
+		if (end < raw[i].start)
+			end = UINT64_MAX;
+
+		boundaries[boundary_count].address = raw[i].start;
+		boundaries[boundary_count].precedence = precedence;
+		boundaries[boundary_count].delta = 1;
+		boundary_count++;
+
+		boundaries[boundary_count].address = end;
+		boundaries[boundary_count].precedence = precedence;
+		boundaries[boundary_count].delta = -1;
+		boundary_count++;
+	}
+
+	SystemMemoryMap_sort (boundaries, boundary_count);
+
+	/* Sweep over the boundaries, counting the raw entries of each type that
+	 * cover the part up to the next boundary */
+	uint32_t active[SYSTEM_MEMORY_MAP_TYPE_COUNT] = { 0 };
+	uint32_t count = 0;
+	uint32_t i = 0;
+
+	while (i < boundary_count)
 	{
-		if (mmap->previous == NULL || 
-				mmap->previous->start + mmap->previous->size == mmap->start)
+		uint64_t start = boundaries[i].address;
+
+		for (; i < boundary_count && boundaries[i].address == start; i++)
+			active[boundaries[i].precedence] += boundaries[i].delta;
+
+		if (i == boundary_count)
+			break;
+
+		uint32_t precedence = 0;
+
+		while (precedence < SYSTEM_MEMORY_MAP_TYPE_COUNT && !active[precedence])
+			precedence++;
+
+		/* A hole */
+		if (precedence == SYSTEM_MEMORY_MAP_TYPE_COUNT)
+			continue;
+
+		uint32_t type = SystemMemoryMap_types[precedence];
+		uint64_t size = boundaries[i].address - start;
+
+		if (count > 0)
 		{
-			size = MAX (size, mmap->start + mmap->size);
+			SystemMemoryMap_entry *last = &mmap->entries[count - 1];
+
+			if (last->type == type && last->start + last->size == start)
+			{
+				last->size += size;
+				continue;
+			}
 		}
 
-		mmap = mmap->next;
+		mmap->entries[count].type = type;
+		mmap->entries[count].start = start;
+		mmap->entries[count].size = size;
+		count++;
+	}
+
+	mmap->count = count;
+	return count;
+}
+
+uint64_t SystemMemoryMap_get_memory_size (const SystemMemoryMap *mmap)
+{
+	uint64_t size = 0;
+
+	for (uint32_t i = 0; i < mmap->count; i++)
+	{
+		const SystemMemoryMap_entry *entry = &mmap->entries[i];
+
+		if (i == 0 || entry[-1].start + entry[-1].size == entry->start)
+		{
+			size = MAX (size, entry->start + entry->size);
+		}
 	}
 
 	return size;
 }
+
+void SystemMemoryMap_dump (const SystemMemoryMap *mmap)
+{
+	printf ("System Memory Map: %d entries\n", (int) mmap->count);
+
+	for (uint32_t i = 0; i < mmap->count; i++)
+	{
+		const SystemMemoryMap_entry *entry = &mmap->entries[i];
+		const char *type;
+
+		switch (entry->type)
+		{
+			case SYSTEM_MEMORY_MAP_ENTRY_FREE:
+				type = "free";
+				break;
+
+			case SYSTEM_MEMORY_MAP_ENTRY_ACPI_NVS:
+				type = "ACPI NVS";
+				break;
+
+			case SYSTEM_MEMORY_MAP_ENTRY_ACPI_RECLAIM:
+				type = "ACPI reclaim";
+				break;
+
+			case SYSTEM_MEMORY_MAP_ENTRY_WELL_KNOWN_PC:
+				type = "well known";
+				break;
+
+			default:
+				type = "reserved";
+				break;
+		}
+
+		printf ("  0x%llx - 0x%llx %s\n",
+				(long long) entry->start,
+				(long long) (entry->start + entry->size - 1),
+				type);
+	}
+}
+
+
+/* Function:   SystemMemoryMap_precedence
+ * Purpose:    to look up a type's precedence
+ * Parameters: type: One of SYSTEM_MEMORY_MAP_ENTRY_*
+ * Returns:    The index into SystemMemoryMap_types, that of reserved for
+ *             unknown types */
+static uint32_t SystemMemoryMap_precedence (uint32_t type)
+{
+	for (uint32_t i = 0; i < SYSTEM_MEMORY_MAP_TYPE_COUNT; i++)
+	{
+		if (SystemMemoryMap_types[i] == type)
+			return i;
+	}
+
+	return 0;
+}
+
+/* Function:   SystemMemoryMap_sift_down
+ * Purpose:    to restore the max-heap property below a node whose children
+ *             are heaps
+ * Parameters: boundaries: The heap
+ *             root:       The node
+ *             count:      The number of nodes in the heap */
+static void SystemMemoryMap_sift_down (SystemMemoryMap_boundary *boundaries,
+		uint32_t root, uint32_t count)
+{
+	while (2 * root + 1 < count)
+	{
+		uint32_t child = 2 * root + 1;
+
+		if (child + 1 < count &&
+				boundaries[child + 1].address > boundaries[child].address)
+			child++;
+
+		if (boundaries[root].address >= boundaries[child].address)
+			return;
+
+		SystemMemoryMap_boundary swap = boundaries[root];
+		boundaries[root] = boundaries[child];
+		boundaries[child] = swap;
+
+		root = child;
+	}
+}
+
+/* Function:   SystemMemoryMap_sort
+ * Purpose:    to sort boundaries by address with heapsort, which takes
+ *             O(n log n) without recursion or extra memory
+ * Parameters: boundaries: The boundaries
+ *             count:      Their number */
+static void SystemMemoryMap_sort (SystemMemoryMap_boundary *boundaries,
+		uint32_t count)
+{
+	for (uint32_t i = count / 2; i > 0; i--)
+		SystemMemoryMap_sift_down (boundaries, i - 1, count);
+
+	for (uint32_t end = count; end > 1; end--)
+	{
+		SystemMemoryMap_boundary swap = boundaries[0];
+		boundaries[0] = boundaries[end - 1];
+		boundaries[end - 1] = swap;
+
+		SystemMemoryMap_sift_down (boundaries, 0, end - 1);
+	}
+}
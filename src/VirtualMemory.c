@@ -0,0 +1,561 @@
+#include "VirtualMemory.h"
+#include "stdio.h"
+#include "utils.h"
+
+static VirtualMemory_area *VirtualMemory_new_area (VirtualMemory *vm,
+		uint32_t start, uint32_t size);
+
+static uint32_t VirtualMemory_get_frames (VirtualMemory *vm,
+		uint64_t *frames, uint32_t count, uint32_t *flags);
+
+static void VirtualMemory_put_range (VirtualMemory *vm,
+		VirtualMemory_area *area);
+
+static void VirtualMemory_unmap (VirtualMemory *vm, uint32_t start,
+		uint32_t page_count);
+
+static void VirtualMemory_update (VirtualMemory_area *area);
+
+static VirtualMemory_area *VirtualMemory_balance (VirtualMemory_area *area);
+
+static VirtualMemory_area *VirtualMemory_insert (VirtualMemory_area *root,
+		VirtualMemory_area *area);
+
+static VirtualMemory_area *VirtualMemory_remove (VirtualMemory_area *root,
+		uint32_t start, VirtualMemory_area **removed);
+
+static VirtualMemory_area *VirtualMemory_first_fit (VirtualMemory_area *root,
+		uint32_t size);
+
+static VirtualMemory_area *VirtualMemory_find (VirtualMemory_area *root,
+		uint32_t start);
+
+static VirtualMemory_area *VirtualMemory_find_before (
+		VirtualMemory_area *root, uint32_t address);
+
+
+int VirtualMemory_init (VirtualMemory *vm, Paging *paging,
+		MemoryAllocator *ma, uint32_t start, uint32_t size)
+{
+	vm->paging = paging;
+	vm->ma = ma;
+	vm->start = start & PAGING_ADDRESS_MASK;
+	vm->size = (size - (vm->start - start)) & PAGING_ADDRESS_MASK;
+	vm->free = NULL;
+	vm->used = NULL;
+	vm->used_count = 0;
+	vm->mapped_pages = 0;
+
+	VirtualMemory_area *area = VirtualMemory_new_area (vm, vm->start,
+			vm->size);
+
+	if (!area)
+		return -1;
+
+	vm->free = VirtualMemory_insert (NULL, area);
+
+	return 0;
+}
+
+uint32_t VirtualMemory_reserve (VirtualMemory *vm, size_t size)
+{
+	/* Round up to pages and add the guard page, without overflowing */
+	if (size == 0 || size > vm->size)
+		return 0;
+
+	uint32_t area_size = ((size + PAGING_PAGE_SIZE - 1) & PAGING_ADDRESS_MASK) +
+		PAGING_PAGE_SIZE;
+
+	VirtualMemory_area *area = VirtualMemory_first_fit (vm->free, area_size);
+
+	if (!area)
+		return 0;
+
+	uint32_t start = area->start;
+
+	vm->free = VirtualMemory_remove (vm->free, start, &area);
+
+	/* The rest stays free, the area's node is reused for it if possible */
+	VirtualMemory_area *used = area;
+
+	if (area->size > area_size)
+	{
+		used = VirtualMemory_new_area (vm, start, area_size);
+
+		if (!used)
+		{
+			vm->free = VirtualMemory_insert (vm->free, area);
+			return 0;
+		}
+
+		area->start += area_size;
+		area->size -= area_size;
+		vm->free = VirtualMemory_insert (vm->free, area);
+	}
+
+	vm->used = VirtualMemory_insert (vm->used, used);
+	vm->used_count++;
+
+	return start;
+}
+
+uint32_t VirtualMemory_unreserve (VirtualMemory *vm, uint32_t address)
+{
+	VirtualMemory_area *area;
+
+	vm->used = VirtualMemory_remove (vm->used, address, &area);
+
+	if (!area)
+		return 0;
+
+	uint32_t size = area->size;
+
+	vm->used_count--;
+	VirtualMemory_put_range (vm, area);
+
+	return size;
+}
+
+void *VirtualMemory_alloc (VirtualMemory *vm, size_t size)
+{
+	uint32_t start = VirtualMemory_reserve (vm, size);
+
+	if (!start)
+		return NULL;
+
+	uint32_t page_count = (size + PAGING_PAGE_SIZE - 1) / PAGING_PAGE_SIZE;
+	uint32_t mapped = 0;
+	uint32_t flags = PAGE_FRAME_ALLOCATOR_HIGH;
+
+	while (mapped < page_count)
+	{
+		uint64_t frames[VIRTUAL_MEMORY_BATCH];
+		uint32_t count = VirtualMemory_get_frames (vm, frames,
+				MIN (page_count - mapped, VIRTUAL_MEMORY_BATCH), &flags);
+
+		if (count == 0)
+			break;
+
+		uint32_t i;
+
+		for (i = 0; i < count; i++)
+		{
+			if (Paging_map (vm->paging,
+						start + (mapped + i) * PAGING_PAGE_SIZE, frames[i],
+						PAGING_WRITABLE | PAGING_GLOBAL) < 0)
+				break;
+		}
+
+		mapped += i;
+
+		if (i < count)
+		{
+			PageFrameAllocator_free_batch (vm->paging->pfa, frames + i,
+					count - i);
+			break;
+		}
+	}
+
+	vm->mapped_pages += mapped;
+
+	if (mapped < page_count)
+	{
+		VirtualMemory_unmap (vm, start, mapped);
+		VirtualMemory_unreserve (vm, start);
+
+		return NULL;
+	}
+
+	return (void *) (uintptr_t) start;
+}
+
+void VirtualMemory_free (VirtualMemory *vm, void *ptr)
+{
+	uint32_t start = (uintptr_t) ptr;
+	VirtualMemory_area *area = VirtualMemory_find (vm->used, start);
+
+	if (!area)
+	{
+		printf ("VirtualMemory: Trying to free 0x%x, which is not allocated\n",
+				(int) start);
+		return;
+	}
+
+	VirtualMemory_unmap (vm, start,
+			area->size / PAGING_PAGE_SIZE - 1);
+	VirtualMemory_unreserve (vm, start);
+}
+
+void VirtualMemory_print (VirtualMemory *vm)
+{
+	VirtualMemory_area *largest = vm->free;
+
+	printf ("VirtualMemory: 0x%x - 0x%x, %d areas in use, %d pages mapped, "
+			"largest free area %d KiB\n",
+			(int) vm->start,
+			(int) (vm->start + vm->size - 1),
+			(int) vm->used_count,
+			(int) vm->mapped_pages,
+			largest ? (int) (largest->max_size / 1024) : 0);
+}
+
+
+/* Function:   VirtualMemory_get_frames
+ * Purpose:    to allocate frames to back a buffer. Buffers are only accessed
+ *             through their mapping, hence high memory is used first, which
+ *             leaves normal memory to the identity mapped users. Paging can
+ *             only map frames below 4 GiB though, those above are freed again
+ *             and flags is cleared, so that normal memory is used from then
+ *             on.
+ * Parameters: vm:     The virtual memory
+ *             frames: Receives the frames' addresses
+ *             count:  The number of frames wanted
+ *             flags:  The Page Frame Allocator flags to allocate with
+ * Returns:    The number of frames allocated, 0 if no memory is left */
+static uint32_t VirtualMemory_get_frames (VirtualMemory *vm,
+		uint64_t *frames, uint32_t count, uint32_t *flags)
+{
+	count = PageFrameAllocator_allocate_batch (vm->paging->pfa, frames, count,
+			*flags);
+
+	if (!(*flags & PAGE_FRAME_ALLOCATOR_HIGH))
+		return count;
+
+	/* Move the frames below 4 GiB to the front */
+	uint32_t usable = 0;
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (frames[i] < PAGE_FRAME_ALLOCATOR_PAE_START)
+		{
+			uint64_t swap = frames[usable];
+			frames[usable++] = frames[i];
+			frames[i] = swap;
+		}
+	}
+
+	if (usable < count)
+	{
+		PageFrameAllocator_free_batch (vm->paging->pfa, frames + usable,
+				count - usable);
+		*flags &= ~PAGE_FRAME_ALLOCATOR_HIGH;
+
+		if (usable == 0)
+			return PageFrameAllocator_allocate_batch (vm->paging->pfa, frames,
+					count, *flags);
+	}
+
+	return usable;
+}
+
+/* Function:   VirtualMemory_new_area
+ * Purpose:    to allocate and initialize a tree node
+ * Parameters: vm:    The virtual memory
+ *             start: The area's address
+ *             size:  The area's size
+ * Returns:    The node or NULL if the Memory Allocator failed */
+static VirtualMemory_area *VirtualMemory_new_area (VirtualMemory *vm,
+		uint32_t start, uint32_t size)
+{
+	VirtualMemory_area *area = MemoryAllocator_alloc (vm->ma,
+			sizeof (VirtualMemory_area));
+
+	if (area)
+	{
+		area->start = start;
+		area->size = size;
+		area->left = NULL;
+		area->right = NULL;
+		VirtualMemory_update (area);
+	}
+
+	return area;
+}
+
+/* Function:   VirtualMemory_put_range
+ * Purpose:    to add an area to the free tree and merge it with the free
+ *             areas right before and after it
+ * Parameters: vm:   The virtual memory
+ *             area: The area, which is not in any tree and has no children */
+static void VirtualMemory_put_range (VirtualMemory *vm,
+		VirtualMemory_area *area)
+{
+	VirtualMemory_area *neighbour = VirtualMemory_find_before (vm->free,
+			area->start);
+
+	if (neighbour && neighbour->start + neighbour->size == area->start)
+	{
+		vm->free = VirtualMemory_remove (vm->free, neighbour->start,
+				&neighbour);
+
+		area->start = neighbour->start;
+		area->size += neighbour->size;
+		MemoryAllocator_free (vm->ma, neighbour);
+	}
+
+	/* The end of the window does not wrap around to its start */
+	if (area->start + area->size - vm->start < vm->size)
+	{
+		vm->free = VirtualMemory_remove (vm->free, area->start + area->size,
+				&neighbour);
+
+		if (neighbour)
+		{
+			area->size += neighbour->size;
+			MemoryAllocator_free (vm->ma, neighbour);
+		}
+	}
+
+	vm->free = VirtualMemory_insert (vm->free, area);
+}
+
+/* Function:   VirtualMemory_unmap
+ * Purpose:    to unmap pages and free their frames
+ * Parameters: vm:         The virtual memory
+ *             start:      The first page's address
+ *             page_count: The number of pages */
+static void VirtualMemory_unmap (VirtualMemory *vm, uint32_t start,
+		uint32_t page_count)
+{
+	Paging_flush flush;
+	uint64_t frames[VIRTUAL_MEMORY_BATCH];
+
+	Paging_flush_init (&flush);
+
+	for (uint32_t done = 0; done < page_count;)
+	{
+		uint32_t count = MIN (page_count - done, VIRTUAL_MEMORY_BATCH);
+
+		for (uint32_t i = 0; i < count; i++)
+		{
+			uint32_t address = start + (done + i) * PAGING_PAGE_SIZE;
+
+			Paging_translate (vm->paging, address, &frames[i]);
+			Paging_unmap (vm->paging, address, &flush);
+		}
+
+		/* The frames may only be reused once the TLB forgot them */
+		Paging_flush_commit (vm->paging, &flush);
+		PageFrameAllocator_free_batch (vm->paging->pfa, frames, count);
+
+		done += count;
+	}
+
+	vm->mapped_pages -= page_count;
+}
+
+/* Function:   VirtualMemory_update
+ * Purpose:    to recompute a node's height and the biggest size in its
+ *             subtree from its children
+ * Parameters: area: The node */
+static void VirtualMemory_update (VirtualMemory_area *area)
+{
+	int32_t left = area->left ? area->left->height : 0;
+	int32_t right = area->right ? area->right->height : 0;
+
+	area->height = MAX (left, right) + 1;
+	area->max_size = area->size;
+
+	if (area->left && area->left->max_size > area->max_size)
+		area->max_size = area->left->max_size;
+
+	if (area->right && area->right->max_size > area->max_size)
+		area->max_size = area->right->max_size;
+}
+
+/* Function:   VirtualMemory_balance
+ * Purpose:    to restore the AVL property at a node whose subtrees' heights
+ *             differ by at most 2, with a single or double rotation
+ * Parameters: area: The node
+ * Returns:    The subtree's new root */
+static VirtualMemory_area *VirtualMemory_balance (VirtualMemory_area *area)
+{
+	int32_t left = area->left ? area->left->height : 0;
+	int32_t right = area->right ? area->right->height : 0;
+
+	if (left > right + 1)
+	{
+		VirtualMemory_area *pivot = area->left;
+
+		/* Left-right case: rotate the left child left first */
+		if ((pivot->right ? pivot->right->height : 0) >
+				(pivot->left ? pivot->left->height : 0))
+		{
+			VirtualMemory_area *inner = pivot->right;
+
+			pivot->right = inner->left;
+			inner->left = pivot;
+			VirtualMemory_update (pivot);
+			pivot = inner;
+		}
+
+		area->left = pivot->right;
+		pivot->right = area;
+		VirtualMemory_update (area);
+		VirtualMemory_update (pivot);
+
+		return pivot;
+	}
+
+	if (right > left + 1)
+	{
+		VirtualMemory_area *pivot = area->right;
+
+		/* Right-left case: rotate the right child right first */
+		if ((pivot->left ? pivot->left->height : 0) >
+				(pivot->right ? pivot->right->height : 0))
+		{
+			VirtualMemory_area *inner = pivot->left;
+
+			pivot->left = inner->right;
+			inner->right = pivot;
+			VirtualMemory_update (pivot);
+			pivot = inner;
+		}
+
+		area->right = pivot->left;
+		pivot->left = area;
+		VirtualMemory_update (area);
+		VirtualMemory_update (pivot);
+
+		return pivot;
+	}
+
+	VirtualMemory_update (area);
+
+	return area;
+}
+
+/* Function:   VirtualMemory_insert
+ * Purpose:    to insert a node into a tree ordered by start
+ * Parameters: root: The tree's root
+ *             area: The node, whose children must be NULL
+ * Returns:    The tree's new root */
+static VirtualMemory_area *VirtualMemory_insert (VirtualMemory_area *root,
+		VirtualMemory_area *area)
+{
+	if (!root)
+	{
+		VirtualMemory_update (area);
+		return area;
+	}
+
+	if (area->start < root->start)
+		root->left = VirtualMemory_insert (root->left, area);
+	else
+		root->right = VirtualMemory_insert (root->right, area);
+
+	return VirtualMemory_balance (root);
+}
+
+/* Function:   VirtualMemory_remove
+ * Purpose:    to remove the node with a start address from a tree
+ * Parameters: root:    The tree's root
+ *             start:   The start address
+ *             removed: Set to the removed node, whose children are cleared,
+ *                      or NULL if there is none
+ * Returns:    The tree's new root */
+static VirtualMemory_area *VirtualMemory_remove (VirtualMemory_area *root,
+		uint32_t start, VirtualMemory_area **removed)
+{
+	if (!root)
+	{
+		*removed = NULL;
+		return NULL;
+	}
+
+	if (start < root->start)
+		root->left = VirtualMemory_remove (root->left, start, removed);
+	else if (start > root->start)
+		root->right = VirtualMemory_remove (root->right, start, removed);
+	else
+	{
+		VirtualMemory_area *left = root->left;
+		VirtualMemory_area *right = root->right;
+
+		*removed = root;
+		root->left = NULL;
+		root->right = NULL;
+
+		if (!left || !right)
+			return left ? left : right;
+
+		/* Replace the node by its successor */
+		VirtualMemory_area *successor = right;
+
+		while (successor->left)
+			successor = successor->left;
+
+		VirtualMemory_area *ignored;
+
+		successor->right = VirtualMemory_remove (right, successor->start,
+				&ignored);
+		successor->left = left;
+
+		return VirtualMemory_balance (successor);
+	}
+
+	return VirtualMemory_balance (root);
+}
+
+/* Function:   VirtualMemory_first_fit
+ * Purpose:    to find the free area with the lowest address that is big
+ *             enough
+ * Parameters: root: The free tree's root
+ *             size: The size needed
+ * Returns:    The area or NULL if none is big enough */
+static VirtualMemory_area *VirtualMemory_first_fit (VirtualMemory_area *root,
+		uint32_t size)
+{
+	/* Subtrees without a fitting area are skipped */
+	while (root && root->max_size >= size)
+	{
+		if (root->left && root->left->max_size >= size)
+			root = root->left;
+		else if (root->size >= size)
+			return root;
+		else
+			root = root->right;
+	}
+
+	return NULL;
+}
+
+/* Function:   VirtualMemory_find
+ * Purpose:    to find the node with a start address
+ * Parameters: root:  The tree's root
+ *             start: The start address
+ * Returns:    The node or NULL if there is none */
+static VirtualMemory_area *VirtualMemory_find (VirtualMemory_area *root,
+		uint32_t start)
+{
+	while (root && root->start != start)
+		root = start < root->start ? root->left : root->right;
+
+	return root;
+}
+
+/* Function:   VirtualMemory_find_before
+ * Purpose:    to find the node with the highest start address below an
+ *             address
+ * Parameters: root:    The tree's root
+ *             address: The address
+ * Returns:    The node or NULL if there is none */
+static VirtualMemory_area *VirtualMemory_find_before (
+		VirtualMemory_area *root, uint32_t address)
+{
+	VirtualMemory_area *before = NULL;
+
+	while (root)
+	{
+		if (root->start < address)
+		{
+			before = root;
+			root = root->right;
+		}
+		else
+			root = root->left;
+	}
+
+	return before;
+}
@@ -80,3 +80,123 @@ hypercall1:
 read_tsc:
 	rdtsc
 	ret
+
+
+; Function:   cpu_cpuid
+; Purpose:    to execute cpuid for a leaf (subleaf 0) and store the resulting
+;             registers
+; Parameters: uint32_t leaf, uint32_t regs[4] (EAX, EBX, ECX, EDX)
+; CC:         cdecl
+	global cpu_cpuid
+cpu_cpuid:
+	push ebx
+	push edi
+
+	mov eax, [esp + 12]
+	xor ecx, ecx
+	cpuid
+
+	mov edi, [esp + 16]
+	mov [edi], eax
+	mov [edi + 4], ebx
+	mov [edi + 8], ecx
+	mov [edi + 12], edx
+
+	pop edi
+	pop ebx
+	ret
+
+
+; Function:   read_cr4
+; Purpose:    to read control register 4
+; Parameters: None
+; CC:         cdecl
+	global read_cr4
+read_cr4:
+	mov eax, cr4
+	ret
+
+; Function:   write_cr4
+; Purpose:    to write control register 4
+; Parameters: uint32_t value
+; CC:         cdecl
+	global write_cr4
+write_cr4:
+	mov eax, [esp + 4]
+	mov cr4, eax
+	ret
+
+; Function:   set_cr3
+; Purpose:    to load the physical address of a page directory into CR3
+; Parameters: uint32_t pd
+; CC:         cdecl
+	global set_cr3
+set_cr3:
+	mov eax, [esp + 4]
+	mov cr3, eax
+	ret
+
+; Function:   enable_paging
+; Purpose:    to turn on paging and write protection of read-only pages in
+;             ring 0. Execution continues at the same address, which must be
+;             identity mapped.
+; Parameters: None
+; CC:         cdecl
+	global enable_paging
+enable_paging:
+	mov eax, cr0
+	or eax, 0x80010000
+	mov cr0, eax
+	jmp .flush
+.flush:
+	ret
+
+; Function:   invlpg
+; Purpose:    to invalidate the TLB entry of a page
+; Parameters: uint32_t address within the page
+; CC:         cdecl
+	global invlpg
+invlpg:
+	mov eax, [esp + 4]
+	invlpg [eax]
+	ret
+
+; Function:   wbinvd
+; Purpose:    to write back and invalidate all caches, e.g. after the memory
+;             type of a page changed
+; Parameters: None
+; CC:         cdecl
+	global wbinvd
+wbinvd:
+	wbinvd
+	ret
+
+; Function:   zero_nt
+; Purpose:    to zero memory with non-temporal stores (movnti) that bypass the
+;             caches, so that zeroing does not evict useful data. Requires
+;             SSE2.
+; Parameters: void *dest (4 byte aligned), size_t size (multiple of 16)
+; CC:         cdecl
+	global zero_nt
+zero_nt:
+	mov edx, [esp + 4]
+	mov ecx, [esp + 8]
+	xor eax, eax
+
+	shr ecx, 4
+	jz .done
+
+.loop:
+	movnti [edx], eax
+	movnti [edx + 4], eax
+	movnti [edx + 8], eax
+	movnti [edx + 12], eax
+	add edx, 16
+	dec ecx
+	jnz .loop
+
+	; Order the weakly ordered stores before later ones
+	sfence
+
+.done:
+	ret
@@ -0,0 +1,79 @@
+; Exception handling for the 32 bit part of stage 2. So far, only page faults
+; are handled, all other vectors are not present.
+
+bits 32
+section .text
+
+; Function:   exceptions_init
+; Purpose:    to create the IDT with the page fault handler and load the
+;             IDTR. Interrupts must be disabled, as no IRQ has a handler.
+; Parameters: void (*page_fault) (uint32_t address, uint32_t error_code):
+;             Called on page faults with interrupts disabled. If it returns,
+;             the faulting instruction is restarted.
+; CC:         cdecl
+	global exceptions_init
+exceptions_init:
+	mov eax, [esp + 4]
+	mov [page_fault_handler], eax
+
+	; .bss is not loaded, mark all vectors not present
+	push edi
+	mov edi, IDT
+	mov ecx, IDT_SIZE / 4
+	xor eax, eax
+	cld
+	rep stosd
+	pop edi
+
+	; Page fault is vector no. 14
+	mov eax, isr_PF
+	mov edx, IDT + 0Eh * 8
+
+	mov [edx], ax				; offset bits 0..15
+	mov word [edx + 2], 8h		; selector (code)
+	mov word [edx + 4], 8E00h	; present, 32 bit interrupt gate, DPL 0
+	shr eax, 16
+	mov [edx + 6], ax			; offset bits 16..31
+
+	lidt [idtd]
+	ret
+
+; Function:   isr_PF
+; Purpose:    to handle page faults by calling the registered C handler with
+;             the faulting address (CR2) and the error code
+isr_PF:
+	pushad
+
+	; The ABI requires the stack to be 16 byte aligned before the call, its
+	; alignment at the fault is unknown
+	mov ebp, esp
+	and esp, ~0Fh
+	sub esp, 8
+
+	push dword [ebp + 32]		; error code, pushed before the registers
+	mov eax, cr2
+	push eax
+
+	cld
+	call dword [page_fault_handler]
+
+	mov esp, ebp
+	popad
+
+	add esp, 4					; remove error code
+	iretd
+
+section .data
+
+page_fault_handler dd 0
+
+idtd:
+	dw IDT_SIZE - 1
+	dd IDT
+
+section .bss
+
+; The IDT, all entries but the page fault's are not present
+alignb 8
+IDT resb 8 * 256
+IDT_SIZE equ $ - IDT
@@ -0,0 +1,385 @@
+/* A native build of the slab memory allocator and the arena allocator on top
+ * of the page frame allocator. Physical memory is simulated by a buffer that
+ * the allocators' map hooks point into. Objects are filled with a tag on
+ * allocation that is checked when they are freed, which catches overlapping
+ * objects. Reports throughput and worst case latency.
+ *
+ * Build and run it with 'make hosted-benchmark' in src. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "SystemMemoryMap.h"
+#include "PageFrameAllocator.h"
+#include "MemoryAllocator.h"
+#include "Arena.h"
+
+#define MEMORY_SIZE			0x10000000ULL
+#define OPERATIONS			4000000
+#define SMALL_WORKING_SET	50000
+#define BIG_WORKING_SET		500
+#define BIG_MAX_SIZE		65536
+
+/* Objects allocated and freed together, e.g. while processing a packet. A
+ * burst is one operation. */
+#define BURSTS				20000
+#define BURST_OBJECTS		200
+#define BURST_MAX_SIZE		256
+
+typedef struct _Result Result;
+struct _Result
+{
+	uint64_t operations;
+	uint64_t total_ns;
+	uint64_t worst_ns;
+};
+
+typedef struct _Object Object;
+struct _Object
+{
+	uint8_t *ptr;
+	size_t size;
+	uint8_t tag;
+};
+
+static SystemMemoryMap_entry entries[2];
+static SystemMemoryMap_entry normalized_entries[4];
+static SystemMemoryMap_boundary boundaries[4];
+static SystemMemoryMap mmap = { 0, normalized_entries };
+static uint8_t *arena;
+static int failed;
+
+static uint64_t random_state = 0x2545f4914f6cdd1dULL;
+
+
+static inline uint64_t now_ns (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t next_random (void)
+{
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 7;
+	random_state ^= random_state << 17;
+
+	return (uint32_t) (random_state >> 32);
+}
+
+static inline void result_add (Result *result, uint64_t start)
+{
+	uint64_t duration = now_ns () - start;
+
+	result->operations++;
+	result->total_ns += duration;
+
+	if (duration > result->worst_ns)
+		result->worst_ns = duration;
+}
+
+static void result_print (const char *allocator, const char *benchmark,
+		const char *operation, const Result *result)
+{
+	double seconds = result->total_ns / 1e9;
+
+	printf ("%-6s %-6s %-7s %9llu ops %12.0f ops/s  worst %8llu ns\n",
+			allocator, benchmark, operation,
+			(unsigned long long) result->operations,
+			seconds > 0 ? result->operations / seconds : 0,
+			(unsigned long long) result->worst_ns);
+}
+
+static void check (int condition, const char *what)
+{
+	if (!condition)
+	{
+		printf ("FAILED: %s\n", what);
+		failed = 1;
+	}
+}
+
+/* Function:   arena_map
+ * Purpose:    the allocators' map hook */
+static void *arena_map (uint64_t address)
+{
+	return arena + address;
+}
+
+/* Function:   setup
+ * Purpose:    to initialize a page frame allocator for 256 MiB of memory with
+ *             the real mode area reserved */
+static void setup (PageFrameAllocator *pfa)
+{
+	entries[0].type = SYSTEM_MEMORY_MAP_ENTRY_RESERVED;
+	entries[0].start = 0;
+	entries[0].size = 0x100000;
+
+	entries[1].type = SYSTEM_MEMORY_MAP_ENTRY_FREE;
+	entries[1].start = 0x100000;
+	entries[1].size = MEMORY_SIZE - 0x100000;
+
+	SystemMemoryMap_normalize (&mmap, entries, 2, boundaries);
+
+	pfa->mmap = &mmap;
+	pfa->frame_size = 4096;
+	pfa->frame_count = MEMORY_SIZE / pfa->frame_size;
+	pfa->bitmap_size = ((pfa->frame_count + 31) / 32) * 4;
+	pfa->summary_size = ((pfa->bitmap_size / 4 + 31) / 32) * 4;
+	pfa->bitmap = malloc (pfa->bitmap_size);
+	pfa->summary = malloc (pfa->summary_size);
+	pfa->backend = PAGE_FRAME_ALLOCATOR_BITMAP;
+	pfa->buddy_nodes = NULL;
+	pfa->huge_frames = 1024;
+	pfa->huge_free = NULL;
+	pfa->zero_frame = NULL;
+	pfa->pages = malloc (pfa->frame_count * sizeof (PageFrameAllocator_page));
+
+	if (!pfa->bitmap || !pfa->summary || !pfa->pages)
+	{
+		printf ("Out of memory\n");
+		exit (EXIT_FAILURE);
+	}
+
+	PageFrameAllocator_init_bitmap (pfa);
+}
+
+/* Function:   benchmark
+ * Purpose:    to allocate and free objects of random size between min_size
+ *             and max_size in random order with a bounded working set */
+static void benchmark (const char *name, MemoryAllocator *ma,
+		size_t min_size, size_t max_size, uint32_t working_set_size)
+{
+	Object *working_set = malloc (working_set_size * sizeof (*working_set));
+	Result allocations = {0}, frees = {0};
+	uint32_t count = 0;
+
+	for (uint32_t i = 0; i < OPERATIONS; i++)
+	{
+		if (count < working_set_size && (count == 0 || next_random () % 2))
+		{
+			Object *object = &working_set[count];
+
+			object->size = min_size + next_random () % (max_size - min_size + 1);
+			object->tag = next_random ();
+
+			uint64_t start = now_ns ();
+			object->ptr = MemoryAllocator_alloc (ma, object->size);
+			result_add (&allocations, start);
+
+			if (!object->ptr)
+				continue;
+
+			memset (object->ptr, object->tag, object->size);
+			count++;
+		}
+		else
+		{
+			uint32_t j = next_random () % count;
+			Object object = working_set[j];
+
+			working_set[j] = working_set[--count];
+
+			check (object.ptr[0] == object.tag &&
+					object.ptr[object.size / 2] == object.tag &&
+					object.ptr[object.size - 1] == object.tag,
+					"objects overlap");
+
+			uint64_t start = now_ns ();
+			MemoryAllocator_free (ma, object.ptr);
+			result_add (&frees, start);
+		}
+	}
+
+	while (count > 0)
+		MemoryAllocator_free (ma, working_set[--count].ptr);
+
+	result_print ("heap", name, "alloc", &allocations);
+	result_print ("heap", name, "free", &frees);
+
+	free (working_set);
+}
+
+/* Function:   fill_burst
+ * Purpose:    to choose random sizes and tags for a burst of objects */
+static void fill_burst (Object *objects)
+{
+	for (uint32_t i = 0; i < BURST_OBJECTS; i++)
+	{
+		objects[i].size = 1 + next_random () % BURST_MAX_SIZE;
+		objects[i].tag = next_random ();
+	}
+}
+
+/* Function:   check_burst
+ * Purpose:    to check the tags of a burst of objects */
+static void check_burst (const Object *objects)
+{
+	for (uint32_t i = 0; i < BURST_OBJECTS; i++)
+	{
+		check (objects[i].ptr[0] == objects[i].tag &&
+				objects[i].ptr[objects[i].size - 1] == objects[i].tag,
+				"objects overlap");
+	}
+}
+
+/* Function:   benchmark_burst_heap
+ * Purpose:    to allocate bursts of objects from the heap and free them one by
+ *             one */
+static void benchmark_burst_heap (MemoryAllocator *ma)
+{
+	Object objects[BURST_OBJECTS];
+	Result allocations = {0}, frees = {0};
+
+	for (uint32_t b = 0; b < BURSTS; b++)
+	{
+		fill_burst (objects);
+
+		uint64_t start = now_ns ();
+
+		for (uint32_t i = 0; i < BURST_OBJECTS; i++)
+			objects[i].ptr = MemoryAllocator_alloc (ma, objects[i].size);
+
+		result_add (&allocations, start);
+
+		for (uint32_t i = 0; i < BURST_OBJECTS; i++)
+			memset (objects[i].ptr, objects[i].tag, objects[i].size);
+
+		check_burst (objects);
+
+		/* The frame descriptors lead to the slab headers */
+		for (uint32_t i = 0; i < BURST_OBJECTS; i++)
+		{
+			PageFrameAllocator_page *page = PageFrameAllocator_page_of (
+					ma->pfa, objects[i].ptr - arena);
+			uintptr_t header = (uintptr_t) objects[i].ptr &
+				~(uintptr_t) (MEMORY_ALLOCATOR_SLAB_SIZE - 1);
+
+			check (page && page->refcount == 1 &&
+					page->owner == PAGE_FRAME_ALLOCATOR_OWNER_MEMORY_ALLOCATOR &&
+					(uintptr_t) page->private == header,
+					"frame descriptor not tagged");
+		}
+
+		start = now_ns ();
+
+		for (uint32_t i = 0; i < BURST_OBJECTS; i++)
+			MemoryAllocator_free (ma, objects[i].ptr);
+
+		result_add (&frees, start);
+	}
+
+	result_print ("heap", "burst", "alloc", &allocations);
+	result_print ("heap", "burst", "free", &frees);
+}
+
+/* Function:   benchmark_burst_arena
+ * Purpose:    to allocate bursts of objects from an arena and rewind it after
+ *             each burst */
+static void benchmark_burst_arena (Arena *ar)
+{
+	Object objects[BURST_OBJECTS];
+	Result allocations = {0}, rewinds = {0};
+
+	Arena_mark mark = Arena_get_mark (ar);
+
+	for (uint32_t b = 0; b < BURSTS; b++)
+	{
+		fill_burst (objects);
+
+		uint64_t start = now_ns ();
+
+		for (uint32_t i = 0; i < BURST_OBJECTS; i++)
+			objects[i].ptr = Arena_alloc (ar, objects[i].size);
+
+		result_add (&allocations, start);
+
+		for (uint32_t i = 0; i < BURST_OBJECTS; i++)
+			memset (objects[i].ptr, objects[i].tag, objects[i].size);
+
+		check_burst (objects);
+
+		start = now_ns ();
+		Arena_rewind (ar, mark);
+		result_add (&rewinds, start);
+	}
+
+	result_print ("arena", "burst", "alloc", &allocations);
+	result_print ("arena", "burst", "rewind", &rewinds);
+}
+
+/* Function:   benchmark_big_arena
+ * Purpose:    to check that objects bigger than a chunk are placed correctly
+ *             and rewound */
+static void benchmark_big_arena (Arena *ar)
+{
+	Arena_mark mark = Arena_get_mark (ar);
+
+	uint8_t *small = Arena_alloc (ar, 16);
+	uint8_t *big = Arena_alloc_aligned (ar, 5 * ARENA_CHUNK_FRAMES * 4096, 4096);
+	uint8_t *after = Arena_alloc (ar, 16);
+
+	check (small && big && after, "big arena allocation failed");
+	check (((uintptr_t) big & 4095) == 0, "misaligned arena object");
+
+	if (big)
+		memset (big, 0xaa, 5 * ARENA_CHUNK_FRAMES * 4096);
+
+	Arena_rewind (ar, mark);
+}
+
+
+int main (void)
+{
+	PageFrameAllocator pfa;
+	MemoryAllocator ma;
+
+	arena = aligned_alloc (MEMORY_ALLOCATOR_SLAB_SIZE, MEMORY_SIZE);
+
+	if (!arena)
+	{
+		printf ("Out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	setup (&pfa);
+
+	uint32_t initially_free = pfa.free_frame_count;
+
+	MemoryAllocator_init (&ma, &pfa);
+	ma.map = arena_map;
+
+#ifdef MEMORY_ALLOCATOR_PROFILE
+	ma.profile.clock = now_ns;
+#endif
+
+	benchmark ("small", &ma, 1, MEMORY_ALLOCATOR_MAX_SIZE, SMALL_WORKING_SET);
+	benchmark ("big", &ma, MEMORY_ALLOCATOR_MAX_SIZE + 1, BIG_MAX_SIZE,
+			BIG_WORKING_SET);
+
+	benchmark_burst_heap (&ma);
+	MemoryAllocator_print_profile (&ma, 8);
+
+	MemoryAllocator_trim (&ma);
+	check (pfa.free_frame_count == initially_free, "frames lost");
+
+	Arena ar;
+
+	Arena_init (&ar, &pfa);
+	ar.map = arena_map;
+
+	benchmark_burst_arena (&ar);
+	benchmark_big_arena (&ar);
+
+	Arena_release (&ar);
+	check (pfa.free_frame_count == initially_free, "arena frames lost");
+
+	free (pfa.bitmap);
+	free (pfa.summary);
+	free (pfa.pages);
+	free (arena);
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
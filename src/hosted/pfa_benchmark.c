@@ -0,0 +1,635 @@
+/* A native build of the page frame allocator and page frame cache, which are
+ * freestanding and hardware independent, fed with synthetic memory maps. It
+ * checks that every frame is handed out at most once and that all frames are
+ * free again after each benchmark, and reports throughput and worst case
+ * latency.
+ *
+ * Build and run it with 'make hosted-benchmark' in src. Pass -v to print the
+ * allocator's statistics after each benchmark. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "SystemMemoryMap.h"
+#include "PageFrameAllocator.h"
+#include "PageFrameCache.h"
+
+#define MAX_ENTRIES		16384
+#define CHURN_OPERATIONS	2000000
+#define CHURN_WORKING_SET	4096
+#define RANGE_MAX_FRAMES	64
+#define RANGE_MAX_FAILURES	256
+#define HUGE_FRAMES			1024
+
+typedef struct _Result Result;
+struct _Result
+{
+	uint64_t operations;
+	uint64_t total_ns;
+	uint64_t worst_ns;
+};
+
+/* The raw entries of the current map and the normalized map */
+static SystemMemoryMap_entry entries[MAX_ENTRIES];
+static unsigned int entry_count;
+
+static SystemMemoryMap_entry normalized_entries[2 * MAX_ENTRIES];
+static SystemMemoryMap_boundary boundaries[2 * MAX_ENTRIES];
+static SystemMemoryMap mmap = { 0, normalized_entries };
+
+static int verbose;
+static int failed;
+
+static uint64_t random_state = 0x2545f4914f6cdd1dULL;
+
+static uint8_t scratch_frame[4096];
+
+
+/* Function:   now_ns
+ * Returns:    A monotonic timestamp in nanoseconds */
+static inline uint64_t now_ns (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Function:   next_random
+ * Purpose:    xorshift64, so that runs are reproducible */
+static uint32_t next_random (void)
+{
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 7;
+	random_state ^= random_state << 17;
+
+	return (uint32_t) (random_state >> 32);
+}
+
+static inline void result_add (Result *result, uint64_t start)
+{
+	uint64_t duration = now_ns () - start;
+
+	result->operations++;
+	result->total_ns += duration;
+
+	if (duration > result->worst_ns)
+		result->worst_ns = duration;
+}
+
+static void result_print (const char *map, const char *backend,
+		const char *benchmark, const char *operation, const Result *result)
+{
+	double seconds = result->total_ns / 1e9;
+
+	printf ("%-10s %-6s %-6s %-6s %9llu ops %12.0f ops/s  worst %8llu ns\n",
+			map, backend, benchmark, operation,
+			(unsigned long long) result->operations,
+			seconds > 0 ? result->operations / seconds : 0,
+			(unsigned long long) result->worst_ns);
+}
+
+static void check (int condition, const char *what)
+{
+	if (!condition)
+	{
+		printf ("FAILED: %s\n", what);
+		failed = 1;
+	}
+}
+
+
+/****************************** Synthetic maps ********************************
+ *
+ * SystemMemoryMap_get_memory_size only counts contiguous entries, hence holes
+ * are described by reserved entries like real e820 maps mostly do. Entries
+ * are added as raw entries, map_normalize normalizes them.
+ *
+ *****************************************************************************/
+static void map_clear (void)
+{
+	entry_count = 0;
+}
+
+static void map_add (uint64_t start, uint64_t size, uint32_t type)
+{
+	SystemMemoryMap_entry *entry = &entries[entry_count];
+
+	entry->type = type;
+	entry->start = start;
+	entry->size = size;
+
+	entry_count++;
+}
+
+/* A PC as QEMU presents it with 256 MiB */
+static void map_qemu_256m (void)
+{
+	map_clear ();
+	map_add (0x00000000, 0x0009fc00, SYSTEM_MEMORY_MAP_ENTRY_FREE);
+	map_add (0x0009fc00, 0x00060400, SYSTEM_MEMORY_MAP_ENTRY_RESERVED);
+	map_add (0x00100000, 0x0fee0000, SYSTEM_MEMORY_MAP_ENTRY_FREE);
+	map_add (0x0ffe0000, 0x00020000, SYSTEM_MEMORY_MAP_ENTRY_RESERVED);
+}
+
+/* 4 GiB of address space with the PCI hole below 4 GiB */
+static void map_4g (void)
+{
+	map_clear ();
+	map_add (0x00000000, 0x0009fc00, SYSTEM_MEMORY_MAP_ENTRY_FREE);
+	map_add (0x0009fc00, 0x00060400, SYSTEM_MEMORY_MAP_ENTRY_RESERVED);
+	map_add (0x00100000, 0xbfe00000, SYSTEM_MEMORY_MAP_ENTRY_FREE);
+	map_add (0xbff00000, 0x00100000, SYSTEM_MEMORY_MAP_ENTRY_ACPI_RECLAIM);
+	map_add (0xc0000000, 0x40000000, SYSTEM_MEMORY_MAP_ENTRY_RESERVED);
+}
+
+/* 8 GiB, 5 GiB of it above 4 GiB */
+static void map_8g (void)
+{
+	map_clear ();
+	map_add (0x000000000ULL, 0x00009fc00ULL, SYSTEM_MEMORY_MAP_ENTRY_FREE);
+	map_add (0x00009fc00ULL, 0x000060400ULL, SYSTEM_MEMORY_MAP_ENTRY_RESERVED);
+	map_add (0x000100000ULL, 0x0bff00000ULL, SYSTEM_MEMORY_MAP_ENTRY_FREE);
+	map_add (0x0c0000000ULL, 0x040000000ULL, SYSTEM_MEMORY_MAP_ENTRY_RESERVED);
+	map_add (0x100000000ULL, 0x100000000ULL, SYSTEM_MEMORY_MAP_ENTRY_FREE);
+}
+
+/* 1 GiB with a few large holes, some of them not frame aligned */
+static void map_holes (void)
+{
+	map_clear ();
+	map_add (0x00000000, 0x0009fc00, SYSTEM_MEMORY_MAP_ENTRY_FREE);
+	map_add (0x0009fc00, 0x00060400, SYSTEM_MEMORY_MAP_ENTRY_RESERVED);
+	map_add (0x00100000, 0x00f00000, SYSTEM_MEMORY_MAP_ENTRY_FREE);
+	map_add (0x01000000, 0x00400800, SYSTEM_MEMORY_MAP_ENTRY_RESERVED);
+	map_add (0x01400800, 0x0abff800, SYSTEM_MEMORY_MAP_ENTRY_FREE);
+	map_add (0x0c000000, 0x04000000, SYSTEM_MEMORY_MAP_ENTRY_ACPI_NVS);
+	map_add (0x10000000, 0x2ffff000, SYSTEM_MEMORY_MAP_ENTRY_FREE);
+	map_add (0x3ffff000, 0x00001000, SYSTEM_MEMORY_MAP_ENTRY_RESERVED);
+}
+
+/* 512 MiB of 60 KiB free ranges, each followed by a 4 KiB reserved one */
+static void map_fragmented (void)
+{
+	map_clear ();
+	map_add (0x00000000, 0x00100000, SYSTEM_MEMORY_MAP_ENTRY_RESERVED);
+
+	for (uint64_t start = 0x00100000; start < 0x20000000; start += 0x10000)
+	{
+		map_add (start, 0xf000, SYSTEM_MEMORY_MAP_ENTRY_FREE);
+		map_add (start + 0xf000, 0x1000, SYSTEM_MEMORY_MAP_ENTRY_RESERVED);
+	}
+}
+
+/* 1 GiB reported out of order, with overlaps as buggy firmware does and the
+ * well-known PC ranges stage 2 adds on top */
+static void map_overlaps (void)
+{
+	map_clear ();
+	map_add (0x00100000, 0x3ff00000, SYSTEM_MEMORY_MAP_ENTRY_FREE);
+	map_add (0x0c080000, 0x00100000, SYSTEM_MEMORY_MAP_ENTRY_ACPI_RECLAIM);
+	map_add (0x00000000, 0x000a0000, SYSTEM_MEMORY_MAP_ENTRY_FREE);
+	map_add (0x0c000000, 0x00100000, SYSTEM_MEMORY_MAP_ENTRY_ACPI_NVS);
+	map_add (0x0009f000, 0x00061000, SYSTEM_MEMORY_MAP_ENTRY_RESERVED);
+	map_add (0x3ff00000, 0x00100000, SYSTEM_MEMORY_MAP_ENTRY_RESERVED);
+	map_add (0x20000000, 0x00001000, 0x1234);
+	map_add (0x00000000, 0x00000400, SYSTEM_MEMORY_MAP_ENTRY_WELL_KNOWN_PC);
+	map_add (0x00000400, 0x00000100, SYSTEM_MEMORY_MAP_ENTRY_WELL_KNOWN_PC);
+	map_add (0x0009fc00, 0x00000400, SYSTEM_MEMORY_MAP_ENTRY_WELL_KNOWN_PC);
+	map_add (0x000a0000, 0x00060000, SYSTEM_MEMORY_MAP_ENTRY_WELL_KNOWN_PC);
+}
+
+/* Function:   map_normalize
+ * Purpose:    to normalize the raw entries of the current map and to check
+ *             that the entries are sorted, disjoint and merged and that no
+ *             free entry overlaps a raw entry of another type */
+static void map_normalize (const char *map)
+{
+	Result result = {0};
+	uint64_t start = now_ns ();
+
+	SystemMemoryMap_normalize (&mmap, entries, entry_count, boundaries);
+	result_add (&result, start);
+	result_print (map, "-", "mmap", "norm", &result);
+
+	for (uint32_t i = 1; i < mmap.count; i++)
+	{
+		SystemMemoryMap_entry *previous = &mmap.entries[i - 1];
+		uint64_t end = previous->start + previous->size;
+
+		check (mmap.entries[i].start > end ||
+				(mmap.entries[i].start == end &&
+				 mmap.entries[i].type != previous->type),
+				"memory map not normalized");
+	}
+
+	for (uint32_t i = 0; i < entry_count; i++)
+	{
+		if (entries[i].type == SYSTEM_MEMORY_MAP_ENTRY_FREE)
+			continue;
+
+		/* Binary search for the first entry that ends behind the start */
+		uint32_t low = 0, high = mmap.count;
+
+		while (low < high)
+		{
+			uint32_t middle = (low + high) / 2;
+			SystemMemoryMap_entry *entry = &mmap.entries[middle];
+
+			if (entry->start + entry->size <= entries[i].start)
+				low = middle + 1;
+			else
+				high = middle;
+		}
+
+		for (uint32_t j = low; j < mmap.count &&
+				mmap.entries[j].start < entries[i].start + entries[i].size; j++)
+		{
+			check (mmap.entries[j].type != SYSTEM_MEMORY_MAP_ENTRY_FREE,
+					"free memory overlaps reserved memory");
+		}
+	}
+}
+
+
+/********************************* Benchmarks *********************************/
+
+/* Function:   hosted_zero_frame
+ * Purpose:    to stand in for zeroing frames, which cannot be accessed here.
+ *             Zeroes a scratch frame instead to account for the cost. */
+static void hosted_zero_frame (uint64_t address, size_t size)
+{
+	(void) address;
+
+	for (size_t i = 0; i < size; i += sizeof (scratch_frame))
+		memset (scratch_frame, 0, sizeof (scratch_frame));
+}
+
+/* Function:   setup
+ * Purpose:    to initialize a page frame allocator for the current map the
+ *             way stage2 does. */
+static void setup (PageFrameAllocator *pfa, enum PageFrameAllocator_backend backend)
+{
+	uint64_t memory_size = SystemMemoryMap_get_memory_size (&mmap);
+
+	pfa->mmap = &mmap;
+	pfa->frame_size = 4096;
+	pfa->frame_count = memory_size / pfa->frame_size;
+	pfa->bitmap_size = ((pfa->frame_count + 31) / 32) * 4;
+	pfa->summary_size = ((pfa->bitmap_size / 4 + 31) / 32) * 4;
+	pfa->bitmap = malloc (pfa->bitmap_size);
+	pfa->summary = malloc (pfa->summary_size);
+	pfa->backend = backend;
+	pfa->buddy_nodes = NULL;
+	pfa->huge_frames = HUGE_FRAMES;
+	pfa->huge_free = NULL;
+	pfa->zero_frame = hosted_zero_frame;
+	pfa->pages = malloc (pfa->frame_count * sizeof (PageFrameAllocator_page));
+
+	if (backend == PAGE_FRAME_ALLOCATOR_BUDDY)
+		pfa->buddy_nodes = malloc (pfa->frame_count * sizeof (PageFrameAllocator_buddy_node));
+	else
+		pfa->huge_free = malloc ((pfa->frame_count + HUGE_FRAMES - 1) / HUGE_FRAMES * sizeof (uint16_t));
+
+	if (!pfa->bitmap || !pfa->summary || !pfa->pages ||
+			(backend == PAGE_FRAME_ALLOCATOR_BUDDY && !pfa->buddy_nodes) ||
+			(backend == PAGE_FRAME_ALLOCATOR_BITMAP && !pfa->huge_free))
+	{
+		printf ("Out of memory\n");
+		exit (EXIT_FAILURE);
+	}
+
+	PageFrameAllocator_init_bitmap (pfa);
+
+	/* Address 0 means failure, hence frame 0 must never be handed out */
+	PageFrameAllocator_mark_used (pfa, 0);
+}
+
+static void teardown (PageFrameAllocator *pfa)
+{
+	if (verbose)
+		PageFrameAllocator_dump_stats (pfa, 1);
+
+	free (pfa->bitmap);
+	free (pfa->summary);
+	free (pfa->buddy_nodes);
+	free (pfa->huge_free);
+	free (pfa->pages);
+}
+
+/* Function:   benchmark_single
+ * Purpose:    to allocate all frames one by one, high memory first, and to
+ *             free them in random order */
+static void benchmark_single (const char *map, const char *backend_name,
+		enum PageFrameAllocator_backend backend)
+{
+	PageFrameAllocator pfa;
+	Result allocations = {0}, frees = {0};
+
+	setup (&pfa, backend);
+
+	uint32_t initially_free = pfa.free_frame_count;
+	uint64_t *addresses = malloc (initially_free * sizeof (*addresses));
+	uint8_t *taken = calloc (pfa.frame_count, 1);
+	uint32_t count = 0;
+
+	uint64_t zeroed = PageFrameAllocator_allocate_flags (&pfa,
+			PAGE_FRAME_ALLOCATOR_HIGH | PAGE_FRAME_ALLOCATOR_ZERO);
+
+	check (zeroed && zeroed < PAGE_FRAME_ALLOCATOR_HIGH_START,
+			"single: zeroed frame from the high zone");
+	PageFrameAllocator_free_range (&pfa, zeroed, 1);
+
+	for (;;)
+	{
+		uint64_t start = now_ns ();
+		uint64_t address = PageFrameAllocator_allocate_flags (
+				&pfa, PAGE_FRAME_ALLOCATOR_HIGH);
+		result_add (&allocations, start);
+
+		if (!address)
+			break;
+
+		check (address / 4096 < pfa.frame_count && !taken[address / 4096],
+				"single: frame handed out twice");
+
+		taken[address / 4096] = 1;
+		addresses[count++] = address;
+	}
+
+	check (count == initially_free, "single: not all free frames allocated");
+
+	for (uint32_t i = count; i > 1; i--)
+	{
+		uint32_t j = next_random () % i;
+		uint64_t tmp = addresses[i - 1];
+
+		addresses[i - 1] = addresses[j];
+		addresses[j] = tmp;
+	}
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint64_t start = now_ns ();
+		PageFrameAllocator_free_range (&pfa, addresses[i], 1);
+		result_add (&frees, start);
+	}
+
+	check (pfa.free_frame_count == initially_free, "single: frames lost");
+
+	result_print (map, backend_name, "single", "alloc", &allocations);
+	result_print (map, backend_name, "single", "free", &frees);
+
+	free (addresses);
+	free (taken);
+	teardown (&pfa);
+}
+
+/* Function:   check_cached
+ * Purpose:    to check that the frames on a CPU's stack of a page frame cache
+ *             are not referenced in their descriptors */
+static void check_cached (PageFrameAllocator *pfa, const PageFrameCache_cpu *cpu)
+{
+	for (uint32_t i = 0; i < cpu->count; i++)
+	{
+		const PageFrameAllocator_page *page =
+			PageFrameAllocator_page_of (pfa, cpu->frames[i]);
+
+		check (page->refcount == 0 &&
+				!(page->flags & PAGE_FRAME_ALLOCATOR_PAGE_ALLOCATED),
+				"churn: cached frame marked allocated");
+	}
+}
+
+/* Function:   benchmark_churn
+ * Purpose:    to allocate and free single frames through a page frame cache
+ *             in random order with a bounded working set */
+static void benchmark_churn (const char *map, const char *backend_name,
+		enum PageFrameAllocator_backend backend)
+{
+	PageFrameAllocator pfa;
+	PageFrameCache_cpu cpu;
+	PageFrameCache cache;
+	Result allocations = {0}, frees = {0};
+	uint64_t working_set[CHURN_WORKING_SET];
+	uint32_t count = 0;
+
+	setup (&pfa, backend);
+	PageFrameCache_init (&cache, &pfa, &cpu, 1);
+
+	uint32_t initially_free = pfa.free_frame_count;
+
+	for (uint32_t i = 0; i < CHURN_OPERATIONS; i++)
+	{
+		if (count < CHURN_WORKING_SET && (count == 0 || next_random () % 2))
+		{
+			uint64_t start = now_ns ();
+			uint64_t address = PageFrameCache_allocate (&cache, 0);
+			result_add (&allocations, start);
+
+			if (address)
+			{
+				check (PageFrameAllocator_page_of (&pfa, address)->refcount == 1,
+						"churn: cached frame's descriptor not reset");
+				working_set[count++] = address;
+
+				/* Just refilled */
+				if (cpu.count == PAGE_FRAME_CACHE_BATCH - 1)
+					check_cached (&pfa, &cpu);
+			}
+		}
+		else
+		{
+			uint32_t j = next_random () % count;
+			uint64_t address = working_set[j];
+
+			working_set[j] = working_set[--count];
+
+			uint64_t start = now_ns ();
+			PageFrameCache_free (&cache, 0, address);
+			result_add (&frees, start);
+		}
+	}
+
+	while (count > 0)
+		PageFrameCache_free (&cache, 0, working_set[--count]);
+
+	check_cached (&pfa, &cpu);
+	PageFrameCache_drain (&cache, 0);
+	check (pfa.free_frame_count == initially_free, "churn: frames lost");
+
+	result_print (map, backend_name, "churn", "alloc", &allocations);
+	result_print (map, backend_name, "churn", "free", &frees);
+
+	teardown (&pfa);
+}
+
+/* Function:   benchmark_range
+ * Purpose:    to allocate runs of random size and alignment from all zones
+ *             until RANGE_MAX_FAILURES requests failed and to free them
+ *             again */
+static void benchmark_range (const char *map, const char *backend_name,
+		enum PageFrameAllocator_backend backend)
+{
+	PageFrameAllocator pfa;
+	Result allocations = {0}, frees = {0};
+
+	setup (&pfa, backend);
+
+	uint32_t initially_free = pfa.free_frame_count;
+	uint64_t *addresses = malloc (initially_free * sizeof (*addresses));
+	uint32_t *counts = malloc (initially_free * sizeof (*counts));
+	uint32_t runs = 0;
+	uint32_t failures = 0;
+
+	while (failures < RANGE_MAX_FAILURES)
+	{
+		uint32_t count = 1 + next_random () % RANGE_MAX_FRAMES;
+		uint32_t alignment = 1U << (next_random () % 5);
+
+		uint64_t start = now_ns ();
+		uint64_t address = PageFrameAllocator_allocate_range_flags (
+				&pfa, count, alignment, PAGE_FRAME_ALLOCATOR_HIGH);
+		result_add (&allocations, start);
+
+		if (!address)
+		{
+			failures++;
+			continue;
+		}
+
+		check (address / 4096 % alignment == 0, "range: misaligned run");
+
+		addresses[runs] = address;
+		counts[runs++] = count;
+	}
+
+	for (uint32_t i = 0; i < runs; i++)
+	{
+		uint64_t start = now_ns ();
+		PageFrameAllocator_free_range (&pfa, addresses[i], counts[i]);
+		result_add (&frees, start);
+	}
+
+	check (pfa.free_frame_count == initially_free, "range: frames lost");
+
+	result_print (map, backend_name, "range", "alloc", &allocations);
+	result_print (map, backend_name, "range", "free", &frees);
+
+	free (addresses);
+	free (counts);
+	teardown (&pfa);
+}
+
+
+/* Function:   benchmark_huge
+ * Purpose:    to fragment memory by single frame churn with a working set of
+ *             a quarter of the memory, and to allocate huge pages
+ *             afterwards. The number of huge pages shows how well single
+ *             frame allocations keep huge runs intact. */
+static void benchmark_huge (const char *map, const char *backend_name,
+		enum PageFrameAllocator_backend backend)
+{
+	PageFrameAllocator pfa;
+	Result allocations = {0};
+
+	setup (&pfa, backend);
+
+	uint32_t initially_free = pfa.free_frame_count;
+	uint32_t working_set_size = initially_free / 4;
+	uint64_t *working_set = malloc (working_set_size * sizeof (*working_set));
+	uint64_t *huge = malloc ((initially_free / HUGE_FRAMES + 1) * sizeof (*huge));
+	uint32_t count = 0;
+	uint32_t huge_count = 0;
+
+	for (uint32_t i = 0; i < CHURN_OPERATIONS; i++)
+	{
+		if (count < working_set_size && (count == 0 || next_random () % 2))
+		{
+			uint64_t address = PageFrameAllocator_allocate_flags (
+					&pfa, PAGE_FRAME_ALLOCATOR_HIGH);
+
+			if (address)
+				working_set[count++] = address;
+		}
+		else
+		{
+			uint32_t j = next_random () % count;
+
+			PageFrameAllocator_free_range (&pfa, working_set[j], 1);
+			working_set[j] = working_set[--count];
+		}
+	}
+
+	for (;;)
+	{
+		uint64_t start = now_ns ();
+		uint64_t address = PageFrameAllocator_allocate_huge (
+				&pfa, PAGE_FRAME_ALLOCATOR_HIGH);
+		result_add (&allocations, start);
+
+		if (!address)
+			break;
+
+		check (address / 4096 % HUGE_FRAMES == 0, "huge: misaligned run");
+		huge[huge_count++] = address;
+	}
+
+	for (uint32_t i = 0; i < huge_count; i++)
+		PageFrameAllocator_free_range (&pfa, huge[i], HUGE_FRAMES);
+
+	for (uint32_t i = 0; i < count; i++)
+		PageFrameAllocator_free_range (&pfa, working_set[i], 1);
+
+	check (pfa.free_frame_count == initially_free, "huge: frames lost");
+
+	result_print (map, backend_name, "huge", "alloc", &allocations);
+
+	free (working_set);
+	free (huge);
+	teardown (&pfa);
+}
+
+
+int main (int argc, char **argv)
+{
+	static const struct
+	{
+		const char *name;
+		void (*build) (void);
+	} maps[] = {
+		{ "qemu-256m", map_qemu_256m },
+		{ "4g", map_4g },
+		{ "8g", map_8g },
+		{ "holes", map_holes },
+		{ "fragmented", map_fragmented },
+		{ "overlaps", map_overlaps }
+	};
+
+	static const struct
+	{
+		const char *name;
+		enum PageFrameAllocator_backend backend;
+	} backends[] = {
+		{ "bitmap", PAGE_FRAME_ALLOCATOR_BITMAP },
+		{ "buddy", PAGE_FRAME_ALLOCATOR_BUDDY }
+	};
+
+	verbose = argc > 1 && strcmp (argv[1], "-v") == 0;
+
+	for (unsigned int m = 0; m < sizeof (maps) / sizeof (*maps); m++)
+	{
+		maps[m].build ();
+		map_normalize (maps[m].name);
+
+		for (unsigned int b = 0; b < sizeof (backends) / sizeof (*backends); b++)
+		{
+			benchmark_single (maps[m].name, backends[b].name, backends[b].backend);
+			benchmark_churn (maps[m].name, backends[b].name, backends[b].backend);
+			benchmark_range (maps[m].name, backends[b].name, backends[b].backend);
+			benchmark_huge (maps[m].name, backends[b].name, backends[b].backend);
+		}
+	}
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
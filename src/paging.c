@@ -1,11 +1,628 @@
 #include "paging.h"
+#include "cpu_utils.h"
+#include "exceptions.h"
+#include "cpu/msr.h"
+#include "stdio.h"
+#include "string.h"
 
-void set_cr3 (uint32_t pd)
+static pde *Paging_directory (Paging *paging);
+
+static pte *Paging_get_table (Paging *paging, uint32_t virtual, int create);
+
+static inline void Paging_invalidate (Paging *paging, uint32_t virtual,
+		int global, Paging_flush *flush);
+
+static Paging_range *Paging_find_range (Paging *paging, uint32_t address);
+
+static inline uint32_t Paging_memory_type (Paging *paging, uint32_t flags);
+
+static int Paging_split_large (Paging *paging, uint32_t virtual,
+		Paging_flush *flush);
+
+
+int Paging_init (Paging *paging, PageFrameAllocator *pfa)
+{
+	paging->pfa = pfa;
+	paging->map = NULL;
+	paging->enabled = 0;
+
+	paging->table_count = 0;
+	paging->large_page_count = 0;
+	paging->page_count = 0;
+	paging->invalidations = 0;
+	paging->full_flushes = 0;
+	paging->demand_faults = 0;
+	paging->large_page_splits = 0;
+
+	bzero (paging->ranges, sizeof (paging->ranges));
+
+	uint32_t cpuid_1[4];
+	cpu_cpuid (1, cpuid_1);
+
+	paging->large_pages = (cpuid_1[3] & CPUID_1_EDX_PSE) ? 1 : 0;
+	paging->global_pages = (cpuid_1[3] & CPUID_1_EDX_PGE) ? 1 : 0;
+	paging->pat = (cpuid_1[3] & CPUID_1_EDX_PAT) ? 1 : 0;
+
+	/* Frames of the normal and DMA zones lie below 4 GiB, as required
+	 * without PAE */
+	uint64_t address = PageFrameAllocator_allocate_flags (pfa,
+			PAGE_FRAME_ALLOCATOR_ZERO);
+
+	if (!address)
+		return -1;
+
+	paging->directory_address = address;
+
+	return 0;
+}
+
+int Paging_identity_map (Paging *paging, uint32_t start, uint32_t size,
+		uint32_t flags)
+{
+	uint64_t address = start & PAGING_ADDRESS_MASK;
+	uint64_t end = ((uint64_t) start + size + PAGING_PAGE_SIZE - 1) &
+		PAGING_ADDRESS_MASK;
+
+	while (address < end)
+	{
+		int result;
+
+		if (paging->large_pages &&
+				!(address & (PAGING_LARGE_PAGE_SIZE - 1)) &&
+				end - address >= PAGING_LARGE_PAGE_SIZE)
+		{
+			result = Paging_map_large (paging, address, address, flags);
+			address += PAGING_LARGE_PAGE_SIZE;
+		}
+		else
+		{
+			result = Paging_map (paging, address, address, flags);
+			address += PAGING_PAGE_SIZE;
+		}
+
+		if (result < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+int Paging_map (Paging *paging, uint32_t virtual, uint64_t physical,
+		uint32_t flags)
+{
+	if ((virtual | physical) & (PAGING_PAGE_SIZE - 1) ||
+			physical >= PAGE_FRAME_ALLOCATOR_PAE_START)
+		return -1;
+
+	pte *table = Paging_get_table (paging, virtual, 1);
+
+	if (!table)
+		return -1;
+
+	pte *entry = &table[PAGING_TABLE_INDEX (virtual)];
+
+	if (*entry & PAGING_PRESENT)
+		return -1;
+
+	if (!paging->global_pages)
+		flags &= ~PAGING_GLOBAL;
+
+	flags = Paging_memory_type (paging, flags);
+
+	*entry = (uint32_t) physical | (flags & PAGING_FLAGS_MASK) | PAGING_PRESENT;
+	paging->page_count++;
+
+	/* Not present entries are not cached in the TLB, and Paging_unmap
+	 * invalidates, hence nothing to do */
+	return 0;
+}
+
+int Paging_map_large (Paging *paging, uint32_t virtual, uint64_t physical,
+		uint32_t flags)
+{
+	if (!paging->large_pages ||
+			(virtual | physical) & (PAGING_LARGE_PAGE_SIZE - 1) ||
+			physical >= PAGE_FRAME_ALLOCATOR_PAE_START)
+		return -1;
+
+	pde *entry = &Paging_directory (paging)[PAGING_DIRECTORY_INDEX (virtual)];
+
+	if (*entry & PAGING_PRESENT)
+		return -1;
+
+	if (!paging->global_pages)
+		flags &= ~PAGING_GLOBAL;
+
+	flags = Paging_memory_type (paging, flags);
+
+	*entry = (uint32_t) physical | (flags & PAGING_FLAGS_MASK) |
+		PAGING_PRESENT | PAGING_LARGE;
+	paging->large_page_count++;
+
+	return 0;
+}
+
+int Paging_unmap (Paging *paging, uint32_t virtual, Paging_flush *flush)
 {
+	pde *directory_entry =
+		&Paging_directory (paging)[PAGING_DIRECTORY_INDEX (virtual)];
+
+	if (!(*directory_entry & PAGING_PRESENT))
+		return -1;
+
+	if (*directory_entry & PAGING_LARGE)
+	{
+		int global = *directory_entry & PAGING_GLOBAL;
+
+		*directory_entry = 0;
+		paging->large_page_count--;
+
+		Paging_invalidate (paging, virtual & PAGING_LARGE_ADDRESS_MASK,
+				global, flush);
+
+		return 0;
+	}
+
+	/* Empty page tables are kept, mappings nearby are likely to follow */
+	pte *entry = &Paging_get_table (paging, virtual, 0)
+		[PAGING_TABLE_INDEX (virtual)];
+
+	if (!(*entry & PAGING_PRESENT))
+		return -1;
+
+	int global = *entry & PAGING_GLOBAL;
+
+	*entry = 0;
+	paging->page_count--;
+
+	Paging_invalidate (paging, virtual & PAGING_ADDRESS_MASK, global, flush);
+
+	return 0;
+}
+
+int Paging_translate (Paging *paging, uint32_t virtual, uint64_t *physical)
+{
+	pde directory_entry =
+		Paging_directory (paging)[PAGING_DIRECTORY_INDEX (virtual)];
+
+	if (!(directory_entry & PAGING_PRESENT))
+		return -1;
+
+	if (directory_entry & PAGING_LARGE)
+	{
+		*physical = (directory_entry & PAGING_LARGE_ADDRESS_MASK) |
+			(virtual & ~PAGING_LARGE_ADDRESS_MASK);
+
+		return 0;
+	}
+
+	pte entry = Paging_get_table (paging, virtual, 0)
+		[PAGING_TABLE_INDEX (virtual)];
+
+	if (!(entry & PAGING_PRESENT))
+		return -1;
+
+	*physical = (entry & PAGING_ADDRESS_MASK) |
+		(virtual & ~PAGING_ADDRESS_MASK);
+
+	return 0;
+}
+
+int Paging_set_memory_type (Paging *paging, uint32_t start, uint32_t size,
+		uint32_t type)
+{
+	uint64_t address = start & PAGING_ADDRESS_MASK;
+	uint64_t end = ((uint64_t) start + size + PAGING_PAGE_SIZE - 1) &
+		PAGING_ADDRESS_MASK;
+	int result = 0;
+
+	type = Paging_memory_type (paging, type) & PAGING_MEMORY_TYPE_MASK;
+
+	Paging_flush flush;
+	Paging_flush_init (&flush);
+
+	while (address < end)
+	{
+		pde *directory_entry =
+			&Paging_directory (paging)[PAGING_DIRECTORY_INDEX (address)];
+
+		if (!(*directory_entry & PAGING_PRESENT))
+		{
+			result = -1;
+			break;
+		}
+
+		if (*directory_entry & PAGING_LARGE)
+		{
+			if (!(address & (PAGING_LARGE_PAGE_SIZE - 1)) &&
+					end - address >= PAGING_LARGE_PAGE_SIZE)
+			{
+				*directory_entry =
+					(*directory_entry & ~PAGING_MEMORY_TYPE_MASK) | type;
+				Paging_invalidate (paging, address,
+						*directory_entry & PAGING_GLOBAL, &flush);
+
+				address += PAGING_LARGE_PAGE_SIZE;
+				continue;
+			}
+
+			if (Paging_split_large (paging, address, &flush) < 0)
+			{
+				result = -1;
+				break;
+			}
+		}
+
+		pte *entry = &Paging_get_table (paging, address, 0)
+			[PAGING_TABLE_INDEX (address)];
+
+		if (!(*entry & PAGING_PRESENT))
+		{
+			result = -1;
+			break;
+		}
+
+		*entry = (*entry & ~PAGING_MEMORY_TYPE_MASK) | type;
+		Paging_invalidate (paging, address, *entry & PAGING_GLOBAL, &flush);
+
+		address += PAGING_PAGE_SIZE;
+	}
+
+	Paging_flush_commit (paging, &flush);
+
+	/* Lines cached under the old type must not be written back or hit
+	 * under the new one */
+	if (paging->enabled)
+		wbinvd ();
+
+	return result;
+}
+
+void Paging_enable (Paging *paging)
+{
+	/* Before paging is enabled, no TLB entries and no cache lines carry the
+	 * types of the old PAT */
+	if (paging->pat)
+		wrmsr64 (IA32_PAT, PAGING_PAT_VALUE);
+
+	if (paging->large_pages)
+		write_cr4 (read_cr4 () | PAGING_CR4_PSE);
+
+	set_cr3 (paging->directory_address);
+	enable_paging ();
+
+	if (paging->global_pages)
+		write_cr4 (read_cr4 () | PAGING_CR4_PGE);
+
+	paging->enabled = 1;
 }
 
-void enable_paging (void)
+void Paging_flush_init (Paging_flush *flush)
 {
+	flush->count = 0;
+	flush->global = 0;
 }
 
-void 
+void Paging_flush_add (Paging_flush *flush, uint32_t virtual, int global)
+{
+	if (flush->count < PAGING_FLUSH_THRESHOLD)
+		flush->pages[flush->count] = virtual;
+
+	flush->count++;
+
+	if (global)
+		flush->global = 1;
+}
+
+void Paging_flush_commit (Paging *paging, Paging_flush *flush)
+{
+	if (paging->enabled && flush->count > 0)
+	{
+		if (flush->count > PAGING_FLUSH_THRESHOLD)
+			Paging_flush_all (paging, flush->global);
+		else
+		{
+			for (uint32_t i = 0; i < flush->count; i++)
+				invlpg (flush->pages[i]);
+
+			paging->invalidations += flush->count;
+		}
+	}
+
+	Paging_flush_init (flush);
+}
+
+void Paging_flush_all (Paging *paging, int global)
+{
+	if (!paging->enabled)
+		return;
+
+	/* Toggling CR4.PGE flushes the global entries, too */
+	if (global && paging->global_pages)
+	{
+		uint32_t cr4 = read_cr4 ();
+
+		write_cr4 (cr4 & ~PAGING_CR4_PGE);
+		write_cr4 (cr4);
+	}
+	else
+		set_cr3 (paging->directory_address);
+
+	paging->full_flushes++;
+}
+
+int Paging_reserve (Paging *paging, uint32_t start, uint32_t size,
+		uint32_t flags)
+{
+	uint64_t first = start & PAGING_ADDRESS_MASK;
+	uint64_t end = ((uint64_t) start + size + PAGING_PAGE_SIZE - 1) &
+		~(uint64_t) (PAGING_PAGE_SIZE - 1);
+
+	/* The size must fit into 32 bit and the range must end at or below
+	 * 4 GiB, addresses would wrap around otherwise */
+	if (end == first || end - first > PAGING_ADDRESS_MASK ||
+			end > PAGE_FRAME_ALLOCATOR_PAE_START)
+		return -1;
+
+	Paging_range *free_range = NULL;
+
+	for (int i = 0; i < PAGING_RANGE_COUNT; i++)
+	{
+		Paging_range *range = &paging->ranges[i];
+
+		if (!range->flags)
+		{
+			if (!free_range)
+				free_range = range;
+		}
+		else if (first < (uint64_t) range->start + range->size &&
+				end > range->start)
+			return -1;
+	}
+
+	if (!free_range)
+		return -1;
+
+	free_range->start = first;
+	free_range->size = end - first;
+	free_range->flags = (flags & PAGING_FLAGS_MASK) | PAGING_PRESENT;
+	free_range->page_count = 0;
+
+	return 0;
+}
+
+int Paging_release (Paging *paging, uint32_t start)
+{
+	Paging_range *range = Paging_find_range (paging, start);
+
+	if (!range || range->start != start)
+		return -1;
+
+	Paging_flush flush;
+	Paging_flush_init (&flush);
+
+	/* Stop at the last mapped page, ranges are often touched sparsely */
+	for (uint64_t address = range->start;
+			range->page_count > 0 &&
+			address < (uint64_t) range->start + range->size;
+			address += PAGING_PAGE_SIZE)
+	{
+		uint64_t physical;
+
+		if (Paging_translate (paging, address, &physical) < 0)
+			continue;
+
+		Paging_unmap (paging, address, &flush);
+		PageFrameAllocator_free_range (paging->pfa, physical, 1);
+		range->page_count--;
+	}
+
+	/* Nothing allocates the freed frames before the stale TLB entries are
+	 * gone */
+	Paging_flush_commit (paging, &flush);
+
+	range->flags = 0;
+
+	return 0;
+}
+
+int Paging_handle_fault (Paging *paging, uint32_t address,
+		uint32_t error_code)
+{
+	/* Protection violations are not resolved by mapping a page */
+	if (error_code & PAGE_FAULT_PRESENT)
+		return -1;
+
+	Paging_range *range = Paging_find_range (paging, address);
+
+	if (!range)
+		return -1;
+
+	uint64_t frame = PageFrameAllocator_allocate_flags (paging->pfa,
+			PAGE_FRAME_ALLOCATOR_ZERO);
+
+	if (!frame)
+		return -1;
+
+	if (Paging_map (paging, address & PAGING_ADDRESS_MASK, frame,
+				range->flags) < 0)
+	{
+		PageFrameAllocator_free_range (paging->pfa, frame, 1);
+		return -1;
+	}
+
+	range->page_count++;
+	paging->demand_faults++;
+
+	return 0;
+}
+
+void Paging_print (Paging *paging)
+{
+	printf ("Paging: directory at 0x%x, %s, %s, %s, %d large pages, "
+			"%d pages, %d page tables\n"
+			"Paging: %d invalidations, %d full flushes, %d demand-zero faults, "
+			"%d large pages split\n",
+			(int) paging->directory_address,
+			paging->large_pages ? "PSE" : "no PSE",
+			paging->global_pages ? "PGE" : "no PGE",
+			paging->pat ? "PAT" : "no PAT",
+			(int) paging->large_page_count,
+			(int) paging->page_count,
+			(int) paging->table_count,
+			(int) paging->invalidations,
+			(int) paging->full_flushes,
+			(int) paging->demand_faults,
+			(int) paging->large_page_splits);
+}
+
+
+/* Function:   Paging_directory
+ * Purpose:    to access the page directory
+ * Parameters: paging: The paging structures
+ * Returns:    A pointer to the page directory */
+static pde *Paging_directory (Paging *paging)
+{
+	if (paging->map)
+		return paging->map (paging->directory_address);
+
+	return (pde *) (uintptr_t) paging->directory_address;
+}
+
+/* Function:   Paging_get_table
+ * Purpose:    to access the page table that maps an address, optionally
+ *             allocating it
+ * Parameters: paging:  The paging structures
+ *             virtual: The address
+ *             create:  Whether to allocate a missing page table
+ * Returns:    A pointer to the page table or NULL if there is none (and
+ *             creating failed) or the address is mapped by a large page */
+static pte *Paging_get_table (Paging *paging, uint32_t virtual, int create)
+{
+	pde *entry = &Paging_directory (paging)[PAGING_DIRECTORY_INDEX (virtual)];
+
+	if (*entry & PAGING_LARGE)
+		return NULL;
+
+	if (!(*entry & PAGING_PRESENT))
+	{
+		if (!create)
+			return NULL;
+
+		uint64_t address = PageFrameAllocator_allocate_flags (paging->pfa,
+				PAGE_FRAME_ALLOCATOR_ZERO);
+
+		if (!address)
+			return NULL;
+
+		/* Access is restricted by the table entries */
+		*entry = (uint32_t) address |
+			PAGING_PRESENT | PAGING_WRITABLE | PAGING_USER;
+		paging->table_count++;
+	}
+
+	uint32_t address = *entry & PAGING_ADDRESS_MASK;
+
+	if (paging->map)
+		return paging->map (address);
+
+	return (pte *) (uintptr_t) address;
+}
+
+/* Function:   Paging_invalidate
+ * Purpose:    to drop a page's TLB entry after its mapping changed, if
+ *             paging is enabled, or to add the page to a batch
+ * Parameters: paging:  The paging structures
+ *             virtual: An address within the page
+ *             global:  Whether the page was global
+ *             flush:   The batch or NULL to invalidate right away */
+static inline void Paging_invalidate (Paging *paging, uint32_t virtual,
+		int global, Paging_flush *flush)
+{
+	if (flush)
+		Paging_flush_add (flush, virtual, global);
+	else if (paging->enabled)
+	{
+		invlpg (virtual);
+		paging->invalidations++;
+	}
+}
+
+/* Function:   Paging_find_range
+ * Purpose:    to find the reserved range that contains an address
+ * Parameters: paging:  The paging structures
+ *             address: The address
+ * Returns:    The range or NULL if the address is not reserved */
+static Paging_range *Paging_find_range (Paging *paging, uint32_t address)
+{
+	for (int i = 0; i < PAGING_RANGE_COUNT; i++)
+	{
+		Paging_range *range = &paging->ranges[i];
+
+		if (range->flags && address >= range->start &&
+				address - range->start < range->size)
+			return range;
+	}
+
+	return NULL;
+}
+
+/* Function:   Paging_memory_type
+ * Purpose:    to substitute the memory type in flags if the CPU does not
+ *             support it
+ * Parameters: paging: The paging structures
+ *             flags:  The flags of an entry
+ * Returns:    The flags to use */
+static inline uint32_t Paging_memory_type (Paging *paging, uint32_t flags)
+{
+	/* Without a PAT, write-through alone selects write-through. Uncached
+	 * minus lets an MTRR for write-combining take effect. */
+	if (!paging->pat && (flags & PAGING_MEMORY_TYPE_MASK) ==
+			PAGING_MEMORY_WRITE_COMBINING)
+		return (flags & ~PAGING_MEMORY_TYPE_MASK) |
+			PAGING_MEMORY_UNCACHED_MINUS;
+
+	return flags;
+}
+
+/* Function:   Paging_split_large
+ * Purpose:    to replace a large page by a page table that maps the same
+ *             frames with the same flags
+ * Parameters: paging:  The paging structures
+ *             virtual: An address within the large page
+ *             flush:   The batch the large page is added to
+ * Returns:    0 or -1 if no frame is free for the page table */
+static int Paging_split_large (Paging *paging, uint32_t virtual,
+		Paging_flush *flush)
+{
+	pde *directory_entry =
+		&Paging_directory (paging)[PAGING_DIRECTORY_INDEX (virtual)];
+
+	uint64_t address = PageFrameAllocator_allocate_flags (paging->pfa, 0);
+
+	if (!address)
+		return -1;
+
+	pte *table = paging->map ? paging->map (address) :
+		(pte *) (uintptr_t) address;
+
+	/* Bit 7 is the PAT flag in table entries, but it is not used */
+	uint32_t physical = *directory_entry & PAGING_LARGE_ADDRESS_MASK;
+	uint32_t flags = *directory_entry & PAGING_FLAGS_MASK & ~PAGING_LARGE;
+
+	for (uint32_t i = 0; i < PAGING_ENTRIES; i++)
+		table[i] = (physical + i * PAGING_PAGE_SIZE) | flags;
+
+	*directory_entry = (uint32_t) address |
+		PAGING_PRESENT | PAGING_WRITABLE | PAGING_USER;
+
+	paging->table_count++;
+	paging->large_page_count--;
+	paging->page_count += PAGING_ENTRIES;
+	paging->large_page_splits++;
+
+	Paging_invalidate (paging, virtual & PAGING_LARGE_ADDRESS_MASK,
+			flags & PAGING_GLOBAL, flush);
+
+	return 0;
+}
@@ -1,10 +0,0 @@
-#ifndef PAGING_H
-#define PAGING_H
-
-#include <stddef.h>
-#include <stdint.h>
-
-typedef uint32_t pde;
-typedef uint32_t pte;
-
-#endif /* PAGING_H */
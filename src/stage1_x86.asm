@@ -152,7 +152,7 @@ LBA_to_CHS:
 ; loads a block (512 bytes) from a drive
 ; AX [IN] = LBA,
 ; DL [IN] = BIOS drive number,
-; DI [IN] = destination,
+; ES:DI [IN] = destination,
 ; CF set on error,
 ; no side effects
 drive_read_block:
@@ -173,10 +173,7 @@ drive_read_block:
 	or cl,al
 
 	mov dh, bl
-	mov bx, di
-
-	mov ax,ds
-	mov es,ax  ; set ES to DS
+	mov bx, di  ; ES:BX is the destination
 
 	mov al,1
 	mov ah,2
@@ -196,9 +193,14 @@ drive_read_block:
 ; AX [IN] = LBA start address,
 ; DL [IN] = BIOS drive number,
 ; CX [IN] = count of blocks,
-; DI [IN] = destination,
-; CF set on error
+; ES:DI [IN] = destination, continues in the next segment when DI wraps
+;              around, hence more than 64 KiB can be loaded,
+; CF set on error,
+; ES is preserved
 drive_read:
+	push es
+
+.loop:
 	or cx,cx   ; or cx with itself, or cleares CF
 	jz .done  ; if it is zero, we are done.
 
@@ -208,9 +210,17 @@ drive_read:
 	inc ax
 	dec cx
 	add di,0x200  ; update parameters
-	jmp drive_read
+	jnc .loop
+
+	push bx       ; DI wrapped around, move ES on by 64 KiB
+	mov bx,es
+	add bx,0x1000
+	mov es,bx
+	pop bx
+	jmp .loop
 
 .done:
+	pop es  ; doesn't change CF
 	ret
 
 
@@ -2,56 +2,499 @@
 #include "cpu_utils.h"
 #include "SystemMemoryMap.h"
 #include "PageFrameAllocator.h"
+#include "PageFrameCache.h"
 #include "MemoryAllocator.h"
+#include "Arena.h"
+#include "paging.h"
+#include "VirtualMemory.h"
+#include "exceptions.h"
 #include "stdio.h"
+#include "string.h"
+#include "utils.h"
 #include "cpu/msr.h"
 
 /* This file is compiled for a IA32 target. */
 
-__attribute__((cdecl)) __attribute__((noreturn)) void stage2_i386_c_entry (SystemMemoryMap mmap)
+/* Page frame allocator backend, may be overridden on the command line */
+#ifndef PFA_BACKEND
+#define PFA_BACKEND PAGE_FRAME_ALLOCATOR_BITMAP
+#endif
+
+/* Number of frames allocated by the boot-time allocator benchmark */
+#define PFA_BENCHMARK_FRAMES 1024
+
+/* Number and size of the objects allocated by the heap benchmark */
+#define MA_BENCHMARK_OBJECTS 1024
+#define MA_BENCHMARK_SIZE 64
+
+/* Demand-zero range used to show that only touched pages take frames */
+#define DEMAND_ZERO_TEST_BASE 0xd0000000
+#define DEMAND_ZERO_TEST_SIZE 0x01000000
+#define DEMAND_ZERO_TEST_PAGES 16
+
+/* Window of kernel virtual addresses for virtually contiguous buffers */
+#define VIRTUAL_MEMORY_START 0xe0000000
+#define VIRTUAL_MEMORY_SIZE 0x10000000
+
+/* Size of the buffers allocated by the virtual memory test */
+#define VIRTUAL_MEMORY_TEST_SIZE 0x00400000
+
+/* VGA text mode framebuffer */
+#define VGA_TEXT_BUFFER 0xb8000
+#define VGA_TEXT_SIZE 0x8000
+
+/* Local APIC registers */
+#define LOCAL_APIC_BASE_MASK 0xfffff000ULL
+#define LOCAL_APIC_VERSION 0x30
+
+/* Paging structures, used by the page fault handler */
+static Paging paging;
+
+/* Pages mapped by the TLB benchmark, above the identity mapped low memory.
+ * More pages than the TLB holds would measure misses only. */
+#define TLB_BENCHMARK_PAGES 64
+#define TLB_BENCHMARK_BASE 0xc0000000
+
+/* Function:   zero_frame_nt
+ * Purpose:    zero_frame hook of the page frame allocator that uses
+ *             non-temporal stores. Memory is identity mapped, hence only
+ *             frames below 4 GiB, and once paging is enabled only those below
+ *             PAGE_FRAME_ALLOCATOR_HIGH_START, can be zeroed. */
+static void zero_frame_nt (uint64_t address, size_t size)
+{
+	zero_nt ((void *) (uintptr_t) address, size);
+}
+
+/* Function:   zero_frame_bzero
+ * Purpose:    zero_frame hook of the page frame allocator for CPUs without
+ *             SSE2. The same frames as with zero_frame_nt can be zeroed. */
+static void zero_frame_bzero (uint64_t address, size_t size)
+{
+	bzero ((void *) (uintptr_t) address, size);
+}
+
+/* Function:   benchmark_page_frame_allocator
+ * Purpose:    to measure the cost of single frame allocations and frees at
+ *             boot time and print the cycles per operation. The allocated
+ *             frames are freed again one at a time, hence the usage
+ *             information is the same afterwards, apart from the statistics.
+ * Parameters: pfa: The page frame allocator to benchmark */
+static void benchmark_page_frame_allocator (PageFrameAllocator *pfa)
+{
+	static uint64_t frames[PFA_BENCHMARK_FRAMES];
+	uint32_t hints[PAGE_FRAME_ALLOCATOR_ZONE_COUNT];
+	int count;
+
+	for (int z = 0; z < PAGE_FRAME_ALLOCATOR_ZONE_COUNT; z++)
+		hints[z] = pfa->zones[z].next_free_hint;
+
+	uint64_t start = read_tsc ();
+
+	for (count = 0; count < PFA_BENCHMARK_FRAMES; count++)
+	{
+		frames[count] = PageFrameAllocator_allocate (pfa);
+		if (!frames[count])
+			break;
+	}
+
+	uint64_t allocated = read_tsc ();
+
+	for (int i = 0; i < count; i++)
+		PageFrameAllocator_free_batch (pfa, &frames[i], 1);
+
+	uint64_t freed = read_tsc ();
+
+	for (int z = 0; z < PAGE_FRAME_ALLOCATOR_ZONE_COUNT; z++)
+		pfa->zones[z].next_free_hint = hints[z];
+
+	if (count > 0)
+	{
+		printf ("PFA benchmark: %d frames, %d cycles/alloc, %d cycles/free\n",
+				count,
+				(int) ((allocated - start) / count),
+				(int) ((freed - allocated) / count));
+	}
+}
+
+/* Function:   benchmark_memory_allocator
+ * Purpose:    to measure the cost of small allocations and frees from the
+ *             heap at boot time and print the cycles per operation.
+ * Parameters: ma: The memory allocator to benchmark */
+static void benchmark_memory_allocator (MemoryAllocator *ma)
+{
+	static void *objects[MA_BENCHMARK_OBJECTS];
+	int count;
+
+	uint64_t start = read_tsc ();
+
+	for (count = 0; count < MA_BENCHMARK_OBJECTS; count++)
+	{
+		objects[count] = MemoryAllocator_alloc (ma, MA_BENCHMARK_SIZE);
+		if (!objects[count])
+			break;
+	}
+
+	uint64_t allocated = read_tsc ();
+
+	for (int i = 0; i < count; i++)
+		MemoryAllocator_free (ma, objects[i]);
+
+	uint64_t freed = read_tsc ();
+
+	MemoryAllocator_trim (ma);
+
+	if (count > 0)
+	{
+		printf ("MA benchmark: %d objects, %d cycles/alloc, %d cycles/free\n",
+				count,
+				(int) ((allocated - start) / count),
+				(int) ((freed - allocated) / count));
+	}
+}
+
+/* Function:   benchmark_arena
+ * Purpose:    to measure the cost of the same small allocations as
+ *             benchmark_memory_allocator from an arena, and of rewinding it,
+ *             at boot time and print the cycles per operation. The arena's
+ *             frames are released afterwards.
+ * Parameters: pfa: The page frame allocator the arena takes frames from */
+static void benchmark_arena (PageFrameAllocator *pfa)
+{
+	Arena arena;
+	int count;
+
+	Arena_init (&arena, pfa);
+
+	Arena_mark mark = Arena_get_mark (&arena);
+
+	uint64_t start = read_tsc ();
+
+	for (count = 0; count < MA_BENCHMARK_OBJECTS; count++)
+	{
+		if (!Arena_alloc (&arena, MA_BENCHMARK_SIZE))
+			break;
+	}
+
+	uint64_t allocated = read_tsc ();
+
+	Arena_rewind (&arena, mark);
+
+	uint64_t rewound = read_tsc ();
+
+	Arena_release (&arena);
+
+	if (count > 0)
+	{
+		printf ("Arena benchmark: %d objects, %d cycles/alloc, %d cycles/rewind\n",
+				count,
+				(int) ((allocated - start) / count),
+				(int) (rewound - allocated));
+	}
+}
+
+/* Function:   benchmark_page_frame_cache
+ * Purpose:    to measure the cost of single frame allocations and frees
+ *             through a CPU's page frame cache at boot time and print the
+ *             cycles per operation. The cache is drained afterwards.
+ * Parameters: cache: The page frame cache to benchmark
+ *             cpu:   The calling CPU's index */
+static void benchmark_page_frame_cache (PageFrameCache *cache, unsigned int cpu)
+{
+	static uint64_t frames[PFA_BENCHMARK_FRAMES];
+	int count;
+
+	uint64_t start = read_tsc ();
+
+	for (count = 0; count < PFA_BENCHMARK_FRAMES; count++)
+	{
+		frames[count] = PageFrameCache_allocate (cache, cpu);
+		if (!frames[count])
+			break;
+	}
+
+	uint64_t allocated = read_tsc ();
+
+	for (int i = 0; i < count; i++)
+		PageFrameCache_free (cache, cpu, frames[i]);
+
+	uint64_t freed = read_tsc ();
+
+	PageFrameCache_drain (cache, cpu);
+
+	if (count > 0)
+	{
+		printf ("PFC benchmark: %d frames, %d cycles/alloc, %d cycles/free\n",
+				count,
+				(int) ((allocated - start) / count),
+				(int) ((freed - allocated) / count));
+	}
+}
+
+/* Function:   page_fault
+ * Purpose:    page fault handler. Resolves faults in demand-zero ranges and
+ *             halts on all others.
+ * Parameters: address:    The faulting address
+ *             error_code: The page fault error code */
+static void page_fault (uint32_t address, uint32_t error_code)
+{
+	if (Paging_handle_fault (&paging, address, error_code) < 0)
+	{
+		printf ("FATAL: Page fault at 0x%x, error code 0x%x.\n",
+				(int) address, (int) error_code);
+		cpu_halt ();
+	}
+}
+
+/* Function:   test_demand_zero
+ * Purpose:    to reserve a big demand-zero range, touch a few of its pages
+ *             and print how many frames that took. The range is released
+ *             afterwards. */
+static void test_demand_zero (void)
+{
+	if (Paging_reserve (&paging, DEMAND_ZERO_TEST_BASE, DEMAND_ZERO_TEST_SIZE,
+				PAGING_WRITABLE) < 0)
+		return;
+
+	uint32_t faults = paging.demand_faults;
+	uint32_t nonzero = 0;
+
+	/* Spread the touches over the range */
+	for (uint32_t i = 0; i < DEMAND_ZERO_TEST_PAGES; i++)
+	{
+		volatile uint32_t *p = (volatile uint32_t *) (uintptr_t)
+			(DEMAND_ZERO_TEST_BASE +
+			 i * (DEMAND_ZERO_TEST_SIZE / DEMAND_ZERO_TEST_PAGES));
+
+		nonzero += *p != 0;
+		*p = i;
+	}
+
+	printf ("Demand-zero: %d KiB reserved, %d pages touched, %d frames "
+			"taken, %d not zeroed\n",
+			DEMAND_ZERO_TEST_SIZE / 1024,
+			DEMAND_ZERO_TEST_PAGES,
+			(int) (paging.demand_faults - faults),
+			(int) nonzero);
+
+	Paging_release (&paging, DEMAND_ZERO_TEST_BASE);
+}
+
+/* Function:   test_virtual_memory
+ * Purpose:    to allocate two big virtually contiguous buffers, free the
+ *             first one and allocate it again, touching all pages, and print
+ *             the cycles taken. The buffers are freed afterwards.
+ * Parameters: vm: The virtual memory */
+static void test_virtual_memory (VirtualMemory *vm)
+{
+	uint64_t start = read_tsc ();
+
+	uint8_t *first = VirtualMemory_alloc (vm, VIRTUAL_MEMORY_TEST_SIZE);
+	uint8_t *second = VirtualMemory_alloc (vm, VIRTUAL_MEMORY_TEST_SIZE);
+
+	VirtualMemory_free (vm, first);
+	first = VirtualMemory_alloc (vm, VIRTUAL_MEMORY_TEST_SIZE);
+
+	uint64_t allocated = read_tsc ();
+
+	if (first && second)
+	{
+		memset (first, 1, VIRTUAL_MEMORY_TEST_SIZE);
+		memset (second, 2, VIRTUAL_MEMORY_TEST_SIZE);
+
+		printf ("VirtualMemory test: buffers at 0x%x and 0x%x, %d cycles for "
+				"3 allocations and a free, first is %s\n",
+				(int) (uintptr_t) first,
+				(int) (uintptr_t) second,
+				(int) (allocated - start),
+				first[VIRTUAL_MEMORY_TEST_SIZE - 1] == 1 &&
+				second[0] == 2 ? "intact" : "broken");
+	}
+
+	VirtualMemory_print (vm);
+
+	if (first)
+		VirtualMemory_free (vm, first);
+
+	if (second)
+		VirtualMemory_free (vm, second);
+}
+
+/* Function:   tlb_benchmark_touch
+ * Purpose:    to read one word of each page mapped by the TLB benchmark
+ * Returns:    The cycles taken */
+static uint64_t tlb_benchmark_touch (void)
+{
+	uint64_t start = read_tsc ();
+
+	/* All pages map the same frame, different lines avoid cache conflicts */
+	for (int i = 0; i < TLB_BENCHMARK_PAGES; i++)
+		(void) *(volatile uint32_t *) (uintptr_t) (TLB_BENCHMARK_BASE +
+				i * PAGING_PAGE_SIZE + (i % 64) * 64);
+
+	return read_tsc () - start;
+}
+
+/* Function:   benchmark_tlb
+ * Purpose:    to measure at boot time how global pages keep TLB entries over
+ *             CR3 reloads, and what batching the invalidation of unmapped
+ *             pages saves, and print the cycles. The benchmark's pages are
+ *             unmapped afterwards.
+ * Parameters: paging: The enabled paging structures
+ *             pfa:    The page frame allocator */
+static void benchmark_tlb (Paging *paging, PageFrameAllocator *pfa)
+{
+	uint64_t frame = PageFrameAllocator_allocate (pfa);
+
+	if (!frame)
+		return;
+
+	for (int global = 0; global < 2; global++)
+	{
+		uint64_t reload = 0, unmap = 0;
+		int mapped = 0;
+
+		for (int batched = 0; batched < 2; batched++)
+		{
+			for (mapped = 0; mapped < TLB_BENCHMARK_PAGES; mapped++)
+			{
+				if (Paging_map (paging,
+							TLB_BENCHMARK_BASE + mapped * PAGING_PAGE_SIZE,
+							frame, global ? PAGING_GLOBAL : 0) < 0)
+					break;
+			}
+
+			/* Warm up the TLB, then see what survives a CR3 reload */
+			tlb_benchmark_touch ();
+			set_cr3 (paging->directory_address);
+			reload += tlb_benchmark_touch ();
+
+			Paging_flush flush;
+			Paging_flush_init (&flush);
+
+			uint64_t start = read_tsc ();
+
+			for (int i = 0; i < mapped; i++)
+				Paging_unmap (paging, TLB_BENCHMARK_BASE + i * PAGING_PAGE_SIZE,
+						batched ? &flush : NULL);
+
+			Paging_flush_commit (paging, &flush);
+
+			uint64_t cycles = read_tsc () - start;
+
+			if (batched)
+				printf ("TLB benchmark: %s, %d pages unmapped: %d cycles "
+						"one by one, %d cycles batched\n",
+						global ? "global" : "not global",
+						mapped, (int) unmap, (int) cycles);
+			else
+				unmap = cycles;
+		}
+
+		printf ("TLB benchmark: %s, %d pages touched after CR3 reload: "
+				"%d cycles\n",
+				global ? "global" : "not global",
+				mapped, (int) (reload / 2));
+	}
+
+	PageFrameAllocator_free_range (pfa, frame, 1);
+}
+
+__attribute__((cdecl)) __attribute__((noreturn)) void stage2_i386_c_entry (
+		const SystemMemoryMap_entry *raw_mmap, uint32_t raw_mmap_count)
 {
 	/* Initialize the real console */
 	terminal_initialize ();
 
 	printf ("Hi there, the terminal is initialized now and printf works!\n");
 
+	/* Sort the raw memory map collected in real mode and resolve overlaps */
+	static SystemMemoryMap_entry mmap_entries[2 * SYSTEM_MEMORY_MAP_MAX_ENTRIES];
+	static SystemMemoryMap_boundary mmap_boundaries[2 * SYSTEM_MEMORY_MAP_MAX_ENTRIES];
+	static SystemMemoryMap mmap;
+
+	mmap.entries = mmap_entries;
+
+	uint64_t mmap_start = read_tsc ();
+	SystemMemoryMap_normalize (&mmap, raw_mmap, raw_mmap_count, mmap_boundaries);
+
+	printf ("Memory map: %d raw entries normalized in %d cycles\n",
+			(int) raw_mmap_count, (int) (read_tsc () - mmap_start));
+	SystemMemoryMap_dump (&mmap);
+
 	/* Initialize a page frame allocator */
 	PageFrameAllocator pfa;
 
-	uint64_t memory_size = SystemMemoryMap_get_memory_size (mmap);
+	uint64_t memory_size = SystemMemoryMap_get_memory_size (&mmap);
 
-	pfa.mmap = mmap;
+	pfa.mmap = &mmap;
 	pfa.frame_size = 4096;
-	pfa.frame_count = memory_size / pfa.frame_size;
-	pfa.bitmap_size = (pfa.frame_count + 7) / 8;
+	pfa.frame_count = MIN (memory_size / pfa.frame_size,
+			PAGE_FRAME_ALLOCATOR_NO_FRAME - 1);
+	pfa.bitmap_size = ((pfa.frame_count + 31) / 32) * 4;
+	pfa.summary_size = ((pfa.bitmap_size / 4 + 31) / 32) * 4;
+
+	pfa.backend = PFA_BACKEND;
+
+	/* Zero frames with non-temporal stores if possible to keep the caches
+	 * clean */
+	uint32_t cpuid_1[4];
+	cpu_cpuid (1, cpuid_1);
+
+	if (cpuid_1[3] & CPUID_1_EDX_SSE2)
+		pfa.zero_frame = zero_frame_nt;
+	else
+		pfa.zero_frame = zero_frame_bzero;
+
+	/* Keep 4 MiB runs intact for PSE large pages (paging without PAE) */
+	pfa.huge_frames = 1024;
 
-	/* Round up to full page frames as only those can be allocated so far */
-	pfa.bitmap_size = ((pfa.bitmap_size + pfa.frame_size - 1) / pfa.frame_size) * pfa.frame_size;
+	uint32_t huge_free_size = (pfa.frame_count + pfa.huge_frames - 1) /
+		pfa.huge_frames * sizeof (uint16_t);
 
-	printf ("Memory size: %d MB\n", (int) memory_size / 1024 / 1024);
+	/* The bitmap, its summary, the buddy nodes or huge run counters and the
+	 * frame descriptors are placed next to each other. Round up to full page
+	 * frames as only those can be allocated so far */
+	uint32_t pfa_metadata_size = pfa.bitmap_size + pfa.summary_size;
+
+	if (pfa.backend == PAGE_FRAME_ALLOCATOR_BUDDY)
+		pfa_metadata_size += pfa.frame_count * sizeof (PageFrameAllocator_buddy_node);
+	else
+		pfa_metadata_size += huge_free_size;
+
+	uint32_t pfa_pages_offset = (pfa_metadata_size + 7) & ~7;
+
+	pfa_metadata_size = pfa_pages_offset +
+		pfa.frame_count * sizeof (PageFrameAllocator_page);
+
+	pfa_metadata_size = ((pfa_metadata_size + pfa.frame_size - 1) / pfa.frame_size) * pfa.frame_size;
+
+	printf ("Memory size: %d MB\n", (int) (memory_size / 1024 / 1024));
 
 	/* Figure out a bitmap location */
 	extern uint8_t kernel_end;
 
 	/* Lowest possible bitmap location */
-	uint32_t pfa_bitmap_location = ((intptr_t) &kernel_end + pfa.frame_size - 1) & ~(pfa.frame_size - 1);
+	uint64_t pfa_bitmap_location = ((intptr_t) &kernel_end + pfa.frame_size - 1) & ~(pfa.frame_size - 1);
+
+	/* The metadata must be addressable without PAE */
+	uint64_t pfa_metadata_limit = MIN (memory_size, PAGE_FRAME_ALLOCATOR_PAE_START);
 
 	do
 	{
 		/* Check each mmap entry for intersection */
-		SystemMemoryMap cm = mmap;
 		uint8_t intersection = 0;
 
-		while (cm)
+		for (uint32_t i = 0; i < mmap.count; i++)
 		{
-			if (pfa_bitmap_location + pfa.bitmap_size > cm->start &&
-					pfa_bitmap_location < cm->start + cm->size &&
-					cm->type != SYSTEM_MEMORY_MAP_ENTRY_FREE)
+			SystemMemoryMap_entry *cme = &mmap.entries[i];
+
+			if (pfa_bitmap_location + pfa_metadata_size > cme->start &&
+					pfa_bitmap_location < cme->start + cme->size &&
+					cme->type != SYSTEM_MEMORY_MAP_ENTRY_FREE)
 			{
 				intersection = 1;
 				break;
 			}
-			cm = cm->next;
 		}
 
 		/* If the bitmap does not intersect with any mmap entry, this is a
@@ -62,9 +505,9 @@ __attribute__((cdecl)) __attribute__((noreturn)) void stage2_i386_c_entry (Syste
 		/* Else, try one page frame above. */
 		pfa_bitmap_location += pfa.frame_size;
 	}
-	while (pfa_bitmap_location + pfa.bitmap_size <= memory_size);
+	while (pfa_bitmap_location + pfa_metadata_size <= pfa_metadata_limit);
 
-	if (pfa_bitmap_location + pfa.bitmap_size > memory_size)
+	if (pfa_bitmap_location + pfa_metadata_size > pfa_metadata_limit)
 	{
 		/* No location for the bitmap found. Halt here. */
 		printf ("FATAL: No location for the pfa bitmap found.\n");
@@ -72,6 +515,25 @@ __attribute__((cdecl)) __attribute__((noreturn)) void stage2_i386_c_entry (Syste
 	}
 
 	pfa.bitmap = (uint8_t *) (intptr_t) pfa_bitmap_location;
+	pfa.summary = (uint32_t *) (intptr_t) (pfa_bitmap_location + pfa.bitmap_size);
+	pfa.buddy_nodes = NULL;
+	pfa.huge_free = NULL;
+
+	if (pfa.backend == PAGE_FRAME_ALLOCATOR_BUDDY)
+	{
+		pfa.buddy_nodes = (PageFrameAllocator_buddy_node *) (intptr_t)
+			(pfa_bitmap_location + pfa.bitmap_size + pfa.summary_size);
+	}
+	else
+	{
+		pfa.huge_free = (uint16_t *) (intptr_t)
+			(pfa_bitmap_location + pfa.bitmap_size + pfa.summary_size);
+	}
+
+	pfa.pages = (PageFrameAllocator_page *) (intptr_t)
+		(pfa_bitmap_location + pfa_pages_offset);
+
+	uint64_t pfa_init_start = read_tsc ();
 	PageFrameAllocator_init_bitmap (&pfa);
 
 	/* Adapt usage information */
@@ -81,35 +543,99 @@ __attribute__((cdecl)) __attribute__((noreturn)) void stage2_i386_c_entry (Syste
 	uint32_t kernel_first_frame = 0x7E00 / pfa.frame_size;
 	uint32_t kernel_last_frame = (intptr_t ) &kernel_end / pfa.frame_size;
 
-	for (uint32_t frame = kernel_first_frame; frame <= kernel_last_frame; frame++)
-		PageFrameAllocator_mark_used (&pfa, frame);
+	PageFrameAllocator_mark_range_used (
+			&pfa,
+			kernel_first_frame,
+			kernel_last_frame - kernel_first_frame + 1);
 
-	/* PFA bitmap */
+	/* PFA metadata */
 	PageFrameAllocator_mark_range_used (
 			&pfa,
 			(intptr_t) pfa.bitmap / pfa.frame_size,
-			pfa.bitmap_size / pfa.frame_size);
-
-	/* The system memory map */
-	for (SystemMemoryMap_entry *cme = mmap; cme; cme = cme->next)
+			pfa_metadata_size / pfa.frame_size);
+
+	printf ("PFA init: %d cycles, %d free frames\n",
+			(int) (read_tsc () - pfa_init_start),
+			(int) pfa.free_frame_count);
+
+	benchmark_page_frame_allocator (&pfa);
+
+	/* Zeroing frames is best done while there is nothing else to do, which
+	 * is the case right now. Later, an idle loop should top up the pool. */
+	printf ("PFA zero pool: %d frames\n",
+			(int) PageFrameAllocator_refill_zero_pool (
+				&pfa, PAGE_FRAME_ALLOCATOR_ZERO_POOL_SIZE));
+
+	/* Identity map low memory, i.e. everything the page frame allocator
+	 * hands out by default, which includes the kernel and the page tables.
+	 * With PSE, this takes 4 MiB pages only. Being the kernel's, the
+	 * mappings are global. */
+	if (Paging_init (&paging, &pfa) < 0 ||
+			Paging_identity_map (&paging, 0, PAGE_FRAME_ALLOCATOR_HIGH_START,
+				PAGING_WRITABLE | PAGING_GLOBAL) < 0)
 	{
-		if (cme->type != SYSTEM_MEMORY_MAP_ENTRY_FREE)
-		{
-			PageFrameAllocator_mark_range_used (
-					&pfa,
-					(intptr_t) cme->start,
-					cme->size);
-		}
+		printf ("FATAL: Failed to set up paging.\n");
+		cpu_halt ();
 	}
 
-	/* Initialize the memory allocator */
-	/* MemoryAllocator ma;
+	/* The console writes to the framebuffer but never reads from it, so
+	 * combine the writes */
+	if (Paging_set_memory_type (&paging, VGA_TEXT_BUFFER, VGA_TEXT_SIZE,
+				PAGING_MEMORY_WRITE_COMBINING) < 0)
+		printf ("Failed to make the framebuffer write-combining.\n");
+
+	exceptions_init (page_fault);
+	Paging_enable (&paging);
+	benchmark_tlb (&paging, &pfa);
+	test_demand_zero ();
+	Paging_print (&paging);
+
+	/* Put a page frame cache in front of the allocator. There is only the
+	 * bootstrap processor so far. */
+	static PageFrameCache_cpu pfc_cpus[1];
+	PageFrameCache pfc;
 
-	ma.pfa = &pfa;
-	ma. */
+	PageFrameCache_init (&pfc, &pfa, pfc_cpus, 1);
+	benchmark_page_frame_cache (&pfc, 0);
+
+	/* Initialize the memory allocator. Memory is identity mapped. */
+	MemoryAllocator ma;
+
+	MemoryAllocator_init (&ma, &pfa);
+
+#ifdef MEMORY_ALLOCATOR_PROFILE
+	ma.profile.clock = read_tsc;
+#endif
+
+	benchmark_memory_allocator (&ma);
+	MemoryAllocator_print_profile (&ma, 8);
+	benchmark_arena (&pfa);
+
+	/* Big buffers from scattered frames, mapped into a window of the kernel's
+	 * address space */
+	static VirtualMemory vm;
+
+	if (VirtualMemory_init (&vm, &paging, &ma, VIRTUAL_MEMORY_START,
+				VIRTUAL_MEMORY_SIZE) == 0)
+		test_virtual_memory (&vm);
+
+	/* Including the PFA_STATS line for scripted runs */
+	PageFrameAllocator_dump_stats (&pfa, 1);
 
 	/* Well, let's have some fun here! */
-	printf ("APIC base: 0x%llx\n", (long long) rdmsr64 (IA32_APIC_BASE));
+	uint64_t apic_base = rdmsr64 (IA32_APIC_BASE);
+
+	printf ("APIC base: 0x%llx\n", (long long) apic_base);
+
+	/* Device registers must not be cached, nor may writes to them be
+	 * combined or reordered */
+	apic_base &= LOCAL_APIC_BASE_MASK;
+
+	if (apic_base < PAGE_FRAME_ALLOCATOR_PAE_START &&
+			Paging_map (&paging, apic_base, apic_base,
+				PAGING_WRITABLE | PAGING_GLOBAL | PAGING_MEMORY_UNCACHED) == 0)
+		printf ("Local APIC version: 0x%x\n", (int) *(volatile uint32_t *)
+				(uintptr_t) (apic_base + LOCAL_APIC_VERSION));
 
 	printf ("debugctl: 0x%lx\n", (long) rdmsr32 (IA32_DEBUGCTL));
 	printf ("ds area:  0x%llx\n", (long long) rdmsr64 (IA32_DS_AREA));
@@ -679,10 +679,12 @@ entry_of_protected_mode:
 	mov esi, .p_msgCallingCCode
 	call p_print_string
 
-	extern system_memory_map
+	extern system_memory_map_raw
+	extern system_memory_map_raw_count
 
-	sub esp, 12
-	push dword [system_memory_map]
+	sub esp, 8
+	push dword [system_memory_map_raw_count]
+	push dword system_memory_map_raw
 
 	extern stage2_i386_c_entry
 	call stage2_i386_c_entry
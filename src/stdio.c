@@ -297,6 +297,10 @@ uint8_t terminal_column;
 uint8_t terminal_color;
 uint16_t* terminal_buffer;
 
+/* Copy of the framebuffer, which may be write-combining and thus slow to
+ * read, to scroll from */
+static uint16_t terminal_shadow[80 * 25];
+
 static inline uint8_t vga_entry_color (enum vga_color fg, enum vga_color bg) {
 	return fg | bg << 4;
 }
@@ -314,7 +318,8 @@ void terminal_initialize (void) {
 	for (size_t y = 0; y < VGA_HEIGHT; ++y) {
 		for (size_t x = 0; x < VGA_WIDTH; ++x) {
 			const size_t index = y * VGA_WIDTH + x;
-			terminal_buffer[index] = vga_entry (' ', terminal_color);
+			terminal_shadow[index] = vga_entry (' ', terminal_color);
+			terminal_buffer[index] = terminal_shadow[index];
 		}
 	}
 }
@@ -325,7 +330,8 @@ void terminal_setcolor (uint8_t color) {
 
 static void terminal_putentryat (char c, uint8_t color, size_t x, size_t y) {
 	const size_t index = y * VGA_WIDTH + x;
-	terminal_buffer[index] = vga_entry (c, color);
+	terminal_shadow[index] = vga_entry (c, color);
+	terminal_buffer[index] = terminal_shadow[index];
 }
 
 void terminal_putchar (char c) {
@@ -400,7 +406,10 @@ static void terminal_newline(void)
 	{
 		/* Scroll one line up */
 		for (size_t i = 0; i < (VGA_HEIGHT - 1) * VGA_WIDTH; i++)
-			terminal_buffer[i] = terminal_buffer[i + VGA_WIDTH];
+		{
+			terminal_shadow[i] = terminal_shadow[i + VGA_WIDTH];
+			terminal_buffer[i] = terminal_shadow[i];
+		}
 
 		/* Clear last row */
 		for (uint8_t x = 0; x < VGA_WIDTH; x++)